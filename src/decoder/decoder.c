@@ -3,6 +3,10 @@
 #include "decoder_wav.h"
 #include "decoder_flac.h"
 #include <utils.h>
+#include <zephyr/kernel.h>
+#include <errno.h>
+
+K_MEM_SLAB_DEFINE_STATIC(state_pool, DECODER_POOL_SLOT_SIZE, DECODER_POOL_SLOTS, 4);
 
 const struct decoder_interface_t *decoder_get_interface(const char *filename)
 {
@@ -17,3 +21,66 @@ const struct decoder_interface_t *decoder_get_interface(const char *filename)
 	}
 	return NULL;
 }
+
+int decoder_open(struct decoder_t *decoder, const char *path, void *state, size_t state_size)
+{
+	if ((decoder == NULL) || (path == NULL) || (state == NULL)) {
+		return -EINVAL;
+	}
+
+	const struct decoder_interface_t *interface = decoder_get_interface(path);
+	if (interface == NULL) {
+		return -ENOTSUP;
+	}
+
+	if (interface->get_state_size() > state_size) {
+		return -ENOMEM;
+	}
+
+	const int err = interface->init(state, path);
+	if (err) {
+		return err;
+	}
+
+	decoder->interface = interface;
+	decoder->state = state;
+	decoder->pooled = false;
+
+	return 0;
+}
+
+int decoder_open_pooled(struct decoder_t *decoder, const char *path)
+{
+	void *state;
+
+	int err = k_mem_slab_alloc(&state_pool, &state, K_NO_WAIT);
+	if (err) {
+		return -ENOMEM;
+	}
+
+	err = decoder_open(decoder, path, state, DECODER_POOL_SLOT_SIZE);
+	if (err) {
+		k_mem_slab_free(&state_pool, state);
+		return err;
+	}
+
+	decoder->pooled = true;
+
+	return 0;
+}
+
+void decoder_close(struct decoder_t *decoder)
+{
+	if ((decoder == NULL) || !decoder_is_open(decoder)) {
+		return;
+	}
+
+	decoder->interface->deinit(decoder->state);
+	if (decoder->pooled) {
+		k_mem_slab_free(&state_pool, decoder->state);
+	}
+
+	decoder->interface = NULL;
+	decoder->state = NULL;
+	decoder->pooled = false;
+}
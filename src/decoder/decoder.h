@@ -1,5 +1,40 @@
 #pragma once
 
 #include "decoder_interface.h"
+#include "decoder_stream.h"
+#include "decoder_prefetch.h"
+#include <stdbool.h>
+
+#define DECODER_POOL_SLOTS 2 // Allows to have next track opened while current is playing
+#define DECODER_POOL_SLOT_SIZE (1024 * 11) // MP3 frame index and two streams take most of it, each decoder asserts its state fits
+
+/* Open stream - decoder interface bound to its state */
+struct decoder_t
+{
+    const struct decoder_interface_t *interface;
+    void *state;
+    bool pooled;
+};
 
 const struct decoder_interface_t *decoder_get_interface(const char *filename);
+
+/* Opens file in caller provided state memory, state_size has to be at least get_state_size() of the decoder */
+int decoder_open(struct decoder_t *decoder, const char *path, void *state, size_t state_size);
+
+/* Opens file with state taken from internal pool of DECODER_POOL_SLOTS. Pool holds decoder contexts only, Helix and
+ * dr_flac still allocate decoding buffers from the heap on open, about 23 KB for MP3 and up to 37 KB for FLAC. Heap has
+ * to fit two of them for the next track to be opened in advance, otherwise it's started regularly once current one ends. */
+int decoder_open_pooled(struct decoder_t *decoder, const char *path);
+
+void decoder_close(struct decoder_t *decoder);
+
+static inline bool decoder_is_open(const struct decoder_t *decoder)
+{
+    return (decoder->interface != NULL);
+}
+
+/* Makes prefetch thread read ahead of the decoder, stream is detached automatically when closed */
+static inline void decoder_prefetch(struct decoder_t *decoder)
+{
+    decoder_prefetch_attach(decoder->interface->get_stream(decoder->state));
+}
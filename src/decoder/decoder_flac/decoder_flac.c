@@ -6,40 +6,41 @@
 #define DR_FLAC_NO_STDIO
 
 #include "decoder_flac.h"
+#include "decoder.h"
 #include <dr_flac.h>
 #include <zephyr/fs/fs.h>
+#include <zephyr/sys/util.h>
 #include <errno.h>
 
 /* Internal context */
 struct decoder_ctx_t
 {
-    struct fs_file_t fd;
+    decoder_stream_t stream;
 	drflac *flac;
-	struct decoder_interface_t interface;
 };
 
-static struct decoder_ctx_t ctx;
+BUILD_ASSERT(sizeof(struct decoder_ctx_t) <= DECODER_POOL_SLOT_SIZE, "Decoder state does not fit pool slot");
 
 /* Internal functions */
 static size_t decoder_on_read(void *pUserData, void *pBufferOut, size_t bytesToRead)
 {
-    struct fs_file_t *fd = pUserData;
-    const ssize_t bytes_read = fs_read(fd, pBufferOut, bytesToRead);
+    decoder_stream_t *stream = pUserData;
+    const ssize_t bytes_read = decoder_stream_read(stream, pBufferOut, bytesToRead);
     return (bytes_read > 0) ? bytes_read : 0;
 }
 
 static drflac_bool32 decoder_on_seek(void *pUserData, int offset, drflac_seek_origin origin)
 {
-    struct fs_file_t *fd = pUserData;
-    const int err = fs_seek(fd, offset, origin);
+    decoder_stream_t *stream = pUserData;
+    const int err = decoder_stream_seek(stream, offset, origin);
     return (err == 0) ? DRFLAC_TRUE : DRFLAC_FALSE;
 }
 
 static drflac_bool32 decoder_on_tell(void *pUserData, drflac_int64 *pCursor)
 {
-    struct fs_file_t *fd = pUserData;
+    decoder_stream_t *stream = pUserData;
 
-    const off_t pos = fs_tell(fd);
+    const off_t pos = decoder_stream_tell(stream);
     if (pos < 0) {
         return DRFLAC_FALSE;
     }
@@ -49,66 +50,96 @@ static drflac_bool32 decoder_on_tell(void *pUserData, drflac_int64 *pCursor)
     return DRFLAC_TRUE;
 }
 
-static int decoder_init(const char *path)
+static size_t decoder_get_state_size(void)
 {
+	return sizeof(struct decoder_ctx_t);
+}
+
+static int decoder_init(void *state, const char *path)
+{
+	struct decoder_ctx_t *ctx = state;
+
 	/* Open file */
-    fs_file_t_init(&ctx.fd);
-    const int err = fs_open(&ctx.fd, path, FS_O_READ);
+    const int err = decoder_stream_open(&ctx->stream, path);
     if (err) {
         return err;
     }
     
-    /* Initialize decoder */
-    ctx.flac = drflac_open(decoder_on_read, decoder_on_seek, decoder_on_tell, (void *)&ctx.fd, NULL);
-    if (ctx.flac == NULL) {
-        fs_close(&ctx.fd);
+    /* Initialize decoder, it allocates frame buffers from the heap, far larger than pool slot */
+    ctx->flac = drflac_open(decoder_on_read, decoder_on_seek, decoder_on_tell, (void *)&ctx->stream, NULL);
+    if (ctx->flac == NULL) {
+        decoder_stream_close(&ctx->stream);
         return -EIO;
     }
     
 	return 0;
 }
 
-static void decoder_deinit(void)
+static void decoder_deinit(void *state)
 {
-	drflac_close(ctx.flac);
-    fs_close(&ctx.fd);
+	struct decoder_ctx_t *ctx = state;
+
+	drflac_close(ctx->flac);
+    decoder_stream_close(&ctx->stream);
 }
 
-static size_t decoder_read_pcm_frames(int16_t *buffer, size_t frames_to_read)
+static size_t decoder_read_pcm_frames(void *state, int16_t *buffer, size_t frames_to_read)
 {
-	return drflac_read_pcm_frames_s16(ctx.flac, frames_to_read, buffer);
+	struct decoder_ctx_t *ctx = state;
+	return drflac_read_pcm_frames_s16(ctx->flac, frames_to_read, buffer);
 }
 
-static size_t decoder_get_pcm_frames_played(void)
+static int decoder_seek(void *state, size_t pcm_frame)
 {
-	return ctx.flac->currentPCMFrame;
+	struct decoder_ctx_t *ctx = state;
+	return (drflac_seek_to_pcm_frame(ctx->flac, pcm_frame) == DRFLAC_TRUE) ? 0 : -EIO;
 }
 
-static size_t decoder_get_pcm_frames_total(void)
+static decoder_stream_t *decoder_get_stream(void *state)
 {
-	return ctx.flac->totalPCMFrameCount;
+	struct decoder_ctx_t *ctx = state;
+	return &ctx->stream;
 }
 
-static uint32_t decoder_get_sample_rate(void)
+static size_t decoder_get_pcm_frames_played(void *state)
 {
-	return ctx.flac->sampleRate;
+	struct decoder_ctx_t *ctx = state;
+	return ctx->flac->currentPCMFrame;
 }
 
-static uint32_t decoder_get_current_bitrate(void)
+static size_t decoder_get_pcm_frames_total(void *state)
 {
+	struct decoder_ctx_t *ctx = state;
+	return ctx->flac->totalPCMFrameCount;
+}
+
+static uint32_t decoder_get_sample_rate(void *state)
+{
+	struct decoder_ctx_t *ctx = state;
+	return ctx->flac->sampleRate;
+}
+
+static uint32_t decoder_get_current_bitrate(void *state)
+{
+	ARG_UNUSED(state);
 	return 0; // Defined only when total frame count not available
 }
 
+static const struct decoder_interface_t interface = {
+	.get_state_size = decoder_get_state_size,
+	.init = decoder_init,
+	.deinit = decoder_deinit,
+	.read_pcm_frames = decoder_read_pcm_frames,
+	.seek = decoder_seek,
+	.get_stream = decoder_get_stream,
+	.get_pcm_frames_played = decoder_get_pcm_frames_played,
+	.get_pcm_frames_total = decoder_get_pcm_frames_total,
+	.get_sample_rate = decoder_get_sample_rate,
+	.get_current_bitrate = decoder_get_current_bitrate
+};
+
 /* API */
 const struct decoder_interface_t *decoder_flac_get_interface(void)
 {
-	ctx.interface.init = decoder_init;
-	ctx.interface.deinit = decoder_deinit;
-	ctx.interface.read_pcm_frames = decoder_read_pcm_frames;
-	ctx.interface.get_pcm_frames_played = decoder_get_pcm_frames_played;
-	ctx.interface.get_pcm_frames_total = decoder_get_pcm_frames_total;
-	ctx.interface.get_sample_rate = decoder_get_sample_rate;
-	ctx.interface.get_current_bitrate = decoder_get_current_bitrate;
-
-	return &ctx.interface;
+	return &interface;
 }
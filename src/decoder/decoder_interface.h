@@ -1,17 +1,25 @@
 #pragma once
 
+#include "decoder_stream.h"
 #include <stddef.h>
 #include <stdint.h>
 
+/* Decoders keep no global state, every call operates on caller-placed state
+ * of get_state_size() bytes, so multiple streams can be open at once. */
 struct decoder_interface_t
 {
-    int (*init)(const char *path);
-    void (*deinit)(void);
+    size_t (*get_state_size)(void);
 
-    size_t (*read_pcm_frames)(int16_t *buffer, size_t frames_to_read);
+    int (*init)(void *state, const char *path);
+    void (*deinit)(void *state);
+
+    size_t (*read_pcm_frames)(void *state, int16_t *buffer, size_t frames_to_read);
+    int (*seek)(void *state, size_t pcm_frame);
+    void (*idle)(void *state); // Optional, bounded background work done while decoding is throttled
+    decoder_stream_t *(*get_stream)(void *state); // Stream audio data is read from
     
-    size_t (*get_pcm_frames_played)(void);
-	size_t (*get_pcm_frames_total)(void);
-	uint32_t (*get_sample_rate)(void);
-	uint32_t (*get_current_bitrate)(void);
+    size_t (*get_pcm_frames_played)(void *state);
+	size_t (*get_pcm_frames_total)(void *state);
+	uint32_t (*get_sample_rate)(void *state);
+	uint32_t (*get_current_bitrate)(void *state);
 };
@@ -1,9 +1,24 @@
 #include "decoder_mp3.h"
+#include "decoder.h"
+#include "mp3_header.h"
+#include "mp3_index.h"
 #include <zephyr/fs/fs.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/logging/log.h>
+#include <string.h>
 #include <errno.h>
 
 #define USE_HELIX
 
+#define DECODER_SEEK_SKIP_FRAMES 256 // Size of scratch buffer used to skip decoded frames while seeking
+#define DECODER_CHANNELS_NUM 2
+#define DECODER_SEEK_DECODE_MAX_MS 1000 // Seeks forward closer than that are done by decoding rather than jumping
+#define DECODER_DECODER_DELAY 529 // Samples of delay introduced by MP3 synthesis filterbank, on top of encoder delay
+#define DECODER_SEEK_PREROLL_FRAMES 1 // MP3 frames decoded before target to refill bit reservoir
+#define DECODER_INDEX_STEP_FRAMES 64 // Frame headers visited per idle call
+#define DECODER_INDEX_LOOKAHEAD_S 300 // How far ahead of decoding the index is extended
+#define DECODER_RESYNC_BYTES_MAX 4096 // Searched for frame header after jumping to estimated offset, over two largest frames
+
 #ifdef USE_HELIX
 #include <helix_mp3.h>
 #else
@@ -14,55 +29,213 @@
 #include <dr_mp3.h>
 #endif
 
+LOG_MODULE_REGISTER(decoder_mp3);
+
 /* Internal context */
 struct decoder_ctx_t
 {
-    struct fs_file_t fd;
+    decoder_stream_t stream;
 #ifdef USE_HELIX
     helix_mp3_t mp3;
     helix_mp3_io_t mp3_io;
+    mp3_header_t header;
+    uint32_t origin; // File offset Helix is given as the beginning of the stream
+    size_t frame_offset; // PCM frames preceding origin
+    size_t lead_in; // Decoded PCM frames being encoder and decoder delay, not part of the track
+    bool lead_in_pending; // Lead-in is skipped on first read or seek, init may be called from a thread with small stack
+    mp3_index_t index;
+    decoder_stream_t index_stream; // Separate stream, so that building index does not move decoder position
+    bool index_stream_open;
 #else
 	drmp3 mp3;
 #endif
-	struct decoder_interface_t interface;
 };
 
-static struct decoder_ctx_t ctx;
+BUILD_ASSERT(sizeof(struct decoder_ctx_t) <= DECODER_POOL_SLOT_SIZE, "Decoder state does not fit pool slot");
 
 /* Internal functions */
+static size_t decoder_get_pcm_frames_played(void *state);
+static size_t decoder_get_pcm_frames_total(void *state);
+
+static decoder_stream_t *decoder_get_stream(void *state)
+{
+    struct decoder_ctx_t *ctx = state;
+    return &ctx->stream;
+}
+
 #ifdef USE_HELIX
 static size_t decoder_on_read(void *user_data, void *buffer, size_t size)
 {
-    struct fs_file_t *fd = user_data;
-    const ssize_t bytes_read = fs_read(fd, buffer, size);
+    struct decoder_ctx_t *ctx = user_data;
+    const ssize_t bytes_read = decoder_stream_read(&ctx->stream, buffer, size);
     return (bytes_read > 0) ? bytes_read : 0;
 }
 
+/* Helix seeks relative to the beginning of the stream it has been given */
 static int decoder_on_seek(void *user_data, int offset)
 {
-    struct fs_file_t *fd = user_data;
-    return fs_seek(fd, offset, FS_SEEK_SET);
+    struct decoder_ctx_t *ctx = user_data;
+    return decoder_stream_seek(&ctx->stream, ctx->origin + offset, FS_SEEK_SET);
+}
+
+/* Starts Helix at given file offset, which is assumed to correspond to given PCM frame */
+static int decoder_start(struct decoder_ctx_t *ctx, uint32_t origin, size_t frame_offset)
+{
+    ctx->origin = origin;
+    ctx->frame_offset = frame_offset;
+    ctx->lead_in = 0;
+    ctx->lead_in_pending = false;
+
+    const int err = decoder_stream_seek(&ctx->stream, origin, FS_SEEK_SET);
+    if (err) {
+        return err;
+    }
+
+    return helix_mp3_init(&ctx->mp3, &ctx->mp3_io);
+}
+
+static int decoder_restart(struct decoder_ctx_t *ctx, uint32_t origin, size_t frame_offset)
+{
+    helix_mp3_deinit(&ctx->mp3);
+    return decoder_start(ctx, origin, frame_offset);
+}
+
+static void decoder_skip(struct decoder_ctx_t *ctx, size_t frames)
+{
+    int16_t skip_buffer[DECODER_SEEK_SKIP_FRAMES * DECODER_CHANNELS_NUM];
+
+    while (frames > 0) {
+        const size_t frames_to_skip = MIN(frames, DECODER_SEEK_SKIP_FRAMES);
+        const size_t frames_skipped = helix_mp3_read_pcm_frames_s16(&ctx->mp3, skip_buffer, frames_to_skip);
+        if (frames_skipped == 0) {
+            break; // Past the end of file, stay there
+        }
+        frames -= frames_skipped;
+    }
+}
+
+static size_t decoder_get_lead_in_max(const struct decoder_ctx_t *ctx)
+{
+    return ctx->header.has_lame_tag ? (ctx->header.encoder_delay + DECODER_DECODER_DELAY) : 0;
+}
+
+/* Drops encoder and decoder delay at the beginning of the stream, if it is known */
+static void decoder_skip_lead_in(struct decoder_ctx_t *ctx)
+{
+    decoder_skip(ctx, decoder_get_lead_in_max(ctx));
+    ctx->lead_in = helix_mp3_get_pcm_frames_decoded(&ctx->mp3);
+}
+
+static void decoder_skip_lead_in_pending(struct decoder_ctx_t *ctx)
+{
+    if (ctx->lead_in_pending) {
+        ctx->lead_in_pending = false;
+        decoder_skip_lead_in(ctx);
+    }
+}
+
+static void decoder_index_init(struct decoder_ctx_t *ctx, const char *path)
+{
+    const mp3_header_t *header = &ctx->header;
+
+    ctx->index_stream_open = false;
+    mp3_index_init(&ctx->index, header->audio_offset, header->sample_rate);
+    if (header->sample_rate == 0) {
+        ctx->index.complete = true; // First frame not found, nothing to start from
+        return;
+    }
+
+    ctx->index_stream_open = (decoder_stream_open(&ctx->index_stream, path) == 0);
+    ctx->index.complete = !ctx->index_stream_open;
+
+    const size_t bytes_per_hour = mp3_index_get_bytes_per_hour(header->sample_rate, header->samples_per_frame);
+    LOG_INF("Frame index takes %u B per hour, capped at %u B", bytes_per_hour, sizeof(ctx->index.deltas));
+}
+
+static bool decoder_read_frame_header(struct decoder_ctx_t *ctx, uint32_t offset, mp3_frame_info_t *info)
+{
+    uint8_t bytes[MP3_HEADER_FRAME_HEADER_SIZE];
+
+    if (decoder_stream_seek(&ctx->stream, offset, FS_SEEK_SET) != 0) {
+        return false;
+    }
+    if (decoder_stream_read(&ctx->stream, bytes, sizeof(bytes)) != sizeof(bytes)) {
+        return false;
+    }
+    return mp3_header_parse_frame(bytes, info) && (info->sample_rate == ctx->header.sample_rate);
+}
+
+/* Finds frame header at or after given offset, next one has to follow it to rule out sync word found in audio data */
+static int decoder_resync(struct decoder_ctx_t *ctx, uint32_t offset, uint32_t *synced_offset)
+{
+    mp3_frame_info_t info;
+    mp3_frame_info_t next_info;
+
+    for (uint32_t i = 0; i < DECODER_RESYNC_BYTES_MAX; ++i) {
+        if (decoder_read_frame_header(ctx, offset + i, &info) &&
+            decoder_read_frame_header(ctx, offset + i + info.frame_size, &next_info)) {
+            *synced_offset = offset + i;
+            return 0;
+        }
+    }
+
+    return -ENOENT;
+}
+
+/* Jumps to offset extrapolated from indexed part of the stream, for targets beyond it in streams without TOC */
+static int decoder_seek_estimated(struct decoder_ctx_t *ctx, size_t start_frame)
+{
+    uint32_t offset;
+    int err;
+
+    /* Seek right after opening, index has not been started yet */
+    if ((mp3_index_get_frames_covered(&ctx->index) == 0) && ctx->index_stream_open) {
+        mp3_index_extend(&ctx->index, &ctx->index_stream, DECODER_INDEX_STEP_FRAMES);
+    }
+
+    if (!mp3_index_estimate(&ctx->index, start_frame, &offset)) {
+        return -ENOENT;
+    }
+
+    err = decoder_resync(ctx, offset, &offset);
+    if (err) {
+        return err;
+    }
+
+    return decoder_restart(ctx, offset, start_frame * ctx->header.samples_per_frame - decoder_get_lead_in_max(ctx));
+}
+
+static int decoder_rewind(struct decoder_ctx_t *ctx)
+{
+    const int err = decoder_restart(ctx, ctx->header.audio_offset, 0);
+    if (err) {
+        return err;
+    }
+
+    decoder_skip_lead_in(ctx);
+
+    return 0;
 }
 #else
 static size_t decoder_on_read(void *pUserData, void *pBufferOut, size_t bytesToRead)
 {
-    struct fs_file_t *fd = pUserData;
-    const ssize_t bytes_read = fs_read(fd, pBufferOut, bytesToRead);
+    decoder_stream_t *stream = pUserData;
+    const ssize_t bytes_read = decoder_stream_read(stream, pBufferOut, bytesToRead);
     return (bytes_read > 0) ? bytes_read : 0;
 }
 
 static drmp3_bool32 decoder_on_seek(void *pUserData, int offset, drmp3_seek_origin origin)
 {
-    struct fs_file_t *fd = pUserData;
-    const int err = fs_seek(fd, offset, origin);
+    decoder_stream_t *stream = pUserData;
+    const int err = decoder_stream_seek(stream, offset, origin);
     return (err == 0) ? DRMP3_TRUE : DRMP3_FALSE;
 }
 
 static drmp3_bool32 decoder_on_tell(void *pUserData, drmp3_int64 *pCursor)
 {
-    struct fs_file_t *fd = pUserData;
+    decoder_stream_t *stream = pUserData;
 
-    const off_t pos = fs_tell(fd);
+    const off_t pos = decoder_stream_tell(stream);
     if (pos < 0) {
         return DRMP3_FALSE;
     }
@@ -73,29 +246,43 @@ static drmp3_bool32 decoder_on_tell(void *pUserData, drmp3_int64 *pCursor)
 }
 #endif
 
-static int decoder_init(const char *path)
+static size_t decoder_get_state_size(void)
+{
+    return sizeof(struct decoder_ctx_t);
+}
+
+static int decoder_init(void *state, const char *path)
 {
+    struct decoder_ctx_t *ctx = state;
+
     /* Open file */
-    fs_file_t_init(&ctx.fd);
-    int err = fs_open(&ctx.fd, path, FS_O_READ);
+    int err = decoder_stream_open(&ctx->stream, path);
     if (err) {
         return err;
     }
 
     /* Initialize decoder */
 #ifdef USE_HELIX
-    ctx.mp3_io.read = decoder_on_read;
-    ctx.mp3_io.seek = decoder_on_seek;
-    ctx.mp3_io.user_data = &ctx.fd;
+    ctx->mp3_io.read = decoder_on_read;
+    ctx->mp3_io.seek = decoder_on_seek;
+    ctx->mp3_io.user_data = ctx;
+
+    /* Stream without recognizable first frame is left to Helix to deal with */
+    err = mp3_header_parse(&ctx->header, &ctx->stream);
+    if (err) {
+        memset(&ctx->header, 0, sizeof(ctx->header));
+    }
 
-    err = helix_mp3_init(&ctx.mp3, &ctx.mp3_io);
+    err = decoder_start(ctx, ctx->header.audio_offset, 0);
     if (err) {
-        fs_close(&ctx.fd);
+        decoder_stream_close(&ctx->stream);
         return err;
     }
+    ctx->lead_in_pending = true;
+    decoder_index_init(ctx, path);
 #else
-    if (drmp3_init(&ctx.mp3, decoder_on_read, decoder_on_seek, decoder_on_tell, NULL, (void *)&ctx.fd, NULL) != DRMP3_TRUE) {
-        fs_close(&ctx.fd);
+    if (drmp3_init(&ctx->mp3, decoder_on_read, decoder_on_seek, decoder_on_tell, NULL, (void *)&ctx->stream, NULL) != DRMP3_TRUE) {
+        decoder_stream_close(&ctx->stream);
         return -EIO;
     }
 #endif
@@ -103,68 +290,210 @@ static int decoder_init(const char *path)
 	return 0;
 }
 
-static void decoder_deinit(void)
+static void decoder_deinit(void *state)
 {
+    struct decoder_ctx_t *ctx = state;
+
 #ifdef USE_HELIX
-    helix_mp3_deinit(&ctx.mp3);
+    helix_mp3_deinit(&ctx->mp3);
+    if (ctx->index_stream_open) {
+        decoder_stream_close(&ctx->index_stream);
+    }
 #else
-	drmp3_uninit(&ctx.mp3);
+	drmp3_uninit(&ctx->mp3);
 #endif
 
-    fs_close(&ctx.fd);
+    decoder_stream_close(&ctx->stream);
 }
 
-static size_t decoder_read_pcm_frames(int16_t *buffer, size_t frames_to_read)
+static size_t decoder_read_pcm_frames(void *state, int16_t *buffer, size_t frames_to_read)
 {
+    struct decoder_ctx_t *ctx = state;
+
 #ifdef USE_HELIX
-    return helix_mp3_read_pcm_frames_s16(&ctx.mp3, buffer, frames_to_read);
+    decoder_skip_lead_in_pending(ctx);
+
+    /* Drop encoder padding at the end of the track */
+    const size_t frames_total = decoder_get_pcm_frames_total(ctx);
+    if (frames_total > 0) {
+        const size_t frames_played = decoder_get_pcm_frames_played(ctx);
+        frames_to_read = (frames_played < frames_total) ? MIN(frames_to_read, frames_total - frames_played) : 0;
+    }
+
+    return helix_mp3_read_pcm_frames_s16(&ctx->mp3, buffer, frames_to_read);
 #else
-	return drmp3_read_pcm_frames_s16(&ctx.mp3, frames_to_read, buffer);
+	return drmp3_read_pcm_frames_s16(&ctx->mp3, frames_to_read, buffer);
 #endif
 }
 
-static size_t decoder_get_pcm_frames_played(void)
+#ifdef USE_HELIX
+/* Jumps to frame index entry, using TOC from VBR header or to offset estimated from average bitrate when target is far,
+ * otherwise decodes frames until it is reached */
+static int decoder_seek(void *state, size_t pcm_frame)
+{
+    struct decoder_ctx_t *ctx = state;
+    int err;
+
+    decoder_skip_lead_in_pending(ctx);
+
+    const size_t frames_played = decoder_get_pcm_frames_played(ctx);
+    const size_t frames_total = decoder_get_pcm_frames_total(ctx);
+    const size_t decode_max = (helix_mp3_get_sample_rate(&ctx->mp3) * DECODER_SEEK_DECODE_MAX_MS) / MSEC_PER_SEC;
+
+    if ((pcm_frame >= frames_played) && ((pcm_frame - frames_played) <= decode_max)) {
+        decoder_skip(ctx, pcm_frame - frames_played);
+        return 0;
+    }
+
+    /* Within indexed part of the stream jump is exact, beyond it index is still better than rewinding if there is no TOC */
+    const uint32_t samples_per_frame = ctx->header.samples_per_frame;
+    if (samples_per_frame > 0) {
+        const size_t stream_frame = (pcm_frame + decoder_get_lead_in_max(ctx)) / samples_per_frame;
+        const size_t start_frame = (stream_frame > DECODER_SEEK_PREROLL_FRAMES) ? (stream_frame - DECODER_SEEK_PREROLL_FRAMES) : 0;
+        const bool is_indexed = (start_frame < mp3_index_get_frames_covered(&ctx->index));
+
+        uint32_t offset;
+        const uint32_t indexed_frame = mp3_index_lookup(&ctx->index, start_frame, &offset);
+
+        /* Decoding forward from the last indexed frame could take minutes, without estimate it is the only way though */
+        if (!is_indexed && !ctx->header.has_toc) {
+            err = decoder_seek_estimated(ctx, start_frame);
+            if (err == 0) {
+                decoder_skip(ctx, pcm_frame - decoder_get_pcm_frames_played(ctx));
+                return 0;
+            }
+            if (err != -ENOENT) {
+                return err;
+            }
+        }
+
+        if ((indexed_frame > 0) && (is_indexed || !ctx->header.has_toc)) {
+            err = decoder_restart(ctx, offset, (size_t)indexed_frame * samples_per_frame - decoder_get_lead_in_max(ctx));
+            if (err) {
+                return err;
+            }
+            decoder_skip(ctx, pcm_frame - decoder_get_pcm_frames_played(ctx));
+            return 0;
+        }
+    }
+
+    /* Position after TOC jump is approximate, it is taken as the requested one */
+    if (ctx->header.has_toc && (frames_total > 0)) {
+        pcm_frame = MIN(pcm_frame, frames_total);
+        const uint32_t offset = mp3_header_toc_lookup(&ctx->header, pcm_frame, frames_total);
+        return decoder_restart(ctx, offset, pcm_frame);
+    }
+
+    if (pcm_frame < frames_played) {
+        err = decoder_rewind(ctx);
+        if (err) {
+            return err;
+        }
+    }
+
+    decoder_skip(ctx, pcm_frame - decoder_get_pcm_frames_played(ctx));
+
+    return 0;
+}
+
+/* Extends frame index ahead of decoding, in small steps */
+static void decoder_idle(void *state)
+{
+    struct decoder_ctx_t *ctx = state;
+
+    if (ctx->index.complete) {
+        return;
+    }
+
+    const uint32_t samples_per_frame = ctx->header.samples_per_frame;
+    const size_t decoded_frame = (decoder_get_pcm_frames_played(ctx) + decoder_get_lead_in_max(ctx)) / samples_per_frame;
+    const size_t lookahead_frames = (ctx->header.sample_rate * DECODER_INDEX_LOOKAHEAD_S) / samples_per_frame;
+    if (mp3_index_get_frames_covered(&ctx->index) >= (decoded_frame + lookahead_frames)) {
+        return;
+    }
+
+    if (!mp3_index_extend(&ctx->index, &ctx->index_stream, DECODER_INDEX_STEP_FRAMES)) {
+        LOG_INF("Frame index complete, %u frames in %u B", mp3_index_get_frames_covered(&ctx->index), ctx->index.entries * sizeof(uint16_t));
+        decoder_stream_close(&ctx->index_stream);
+        ctx->index_stream_open = false;
+    }
+}
+#else
+static int decoder_seek(void *state, size_t pcm_frame)
+{
+    struct decoder_ctx_t *ctx = state;
+    return (drmp3_seek_to_pcm_frame(&ctx->mp3, pcm_frame) == DRMP3_TRUE) ? 0 : -EIO;
+}
+#endif
+
+static size_t decoder_get_pcm_frames_played(void *state)
 {
+    struct decoder_ctx_t *ctx = state;
+
 #ifdef USE_HELIX
-    return helix_mp3_get_pcm_frames_decoded(&ctx.mp3);
+    return ctx->frame_offset + helix_mp3_get_pcm_frames_decoded(&ctx->mp3) - ctx->lead_in;
 #else
-    return ctx.mp3.currentPCMFrame;
+    return ctx->mp3.currentPCMFrame;
 #endif
 }
 
-static size_t decoder_get_pcm_frames_total(void)
+static size_t decoder_get_pcm_frames_total(void *state)
 {
-	return 0; // The value is not available without decoding whole file
+#ifdef USE_HELIX
+    struct decoder_ctx_t *ctx = state;
+    const mp3_header_t *header = &ctx->header;
+
+    /* Without VBR header the value is not available without decoding whole file */
+    const size_t frames_total = (size_t)header->frames * header->samples_per_frame;
+    const size_t frames_trimmed = header->encoder_delay + header->encoder_padding;
+
+    return (frames_total > frames_trimmed) ? (frames_total - frames_trimmed) : 0;
+#else
+    ARG_UNUSED(state);
+    return 0; // The value is not available without decoding whole file
+#endif
 }
 
-static uint32_t decoder_get_sample_rate(void)
+static uint32_t decoder_get_sample_rate(void *state)
 {
+    struct decoder_ctx_t *ctx = state;
+
 #ifdef USE_HELIX
-    return helix_mp3_get_sample_rate(&ctx.mp3);
+    return helix_mp3_get_sample_rate(&ctx->mp3);
 #else
-	return ctx.mp3.sampleRate;
+	return ctx->mp3.sampleRate;
 #endif
 }
 
-static uint32_t decoder_get_current_bitrate(void)
+static uint32_t decoder_get_current_bitrate(void *state)
 {
+    struct decoder_ctx_t *ctx = state;
+
 #ifdef USE_HELIX
-    return helix_mp3_get_bitrate(&ctx.mp3);
+    return helix_mp3_get_bitrate(&ctx->mp3);
 #else
-    return ctx.mp3.mp3FrameBitrate;
+    return ctx->mp3.mp3FrameBitrate;
 #endif
 }
 
+static const struct decoder_interface_t interface = {
+    .get_state_size = decoder_get_state_size,
+    .init = decoder_init,
+    .deinit = decoder_deinit,
+    .read_pcm_frames = decoder_read_pcm_frames,
+    .seek = decoder_seek,
+#ifdef USE_HELIX
+    .idle = decoder_idle,
+#endif
+    .get_stream = decoder_get_stream,
+    .get_pcm_frames_played = decoder_get_pcm_frames_played,
+    .get_pcm_frames_total = decoder_get_pcm_frames_total,
+    .get_sample_rate = decoder_get_sample_rate,
+    .get_current_bitrate = decoder_get_current_bitrate
+};
+
 /* API */
 const struct decoder_interface_t *decoder_mp3_get_interface(void)
 {
-	ctx.interface.init = decoder_init;
-	ctx.interface.deinit = decoder_deinit;
-	ctx.interface.read_pcm_frames = decoder_read_pcm_frames;
-	ctx.interface.get_pcm_frames_played = decoder_get_pcm_frames_played;
-	ctx.interface.get_pcm_frames_total = decoder_get_pcm_frames_total;
-	ctx.interface.get_sample_rate = decoder_get_sample_rate;
-	ctx.interface.get_current_bitrate = decoder_get_current_bitrate;
-
-	return &ctx.interface;
+    return &interface;
 }
@@ -0,0 +1,320 @@
+#include "mp3_header.h"
+#include <zephyr/sys/util.h>
+#include <string.h>
+#include <errno.h>
+
+#define MP3_HEADER_ID3V2_HEADER_SIZE 10
+#define MP3_HEADER_ID3V2_FOOTER_SIZE 10
+#define MP3_HEADER_ID3V2_FOOTER_FLAG 0x10
+
+#define MP3_HEADER_SYNC_SCAN_MAX (1024 * 8) // Garbage allowed between ID3v2 tag and first frame
+#define MP3_HEADER_BUFFER_SIZE 256 // Fits frame header, side info, Xing header with TOC and LAME tag
+
+#define MP3_HEADER_XING_FLAG_FRAMES 0x01
+#define MP3_HEADER_XING_FLAG_BYTES 0x02
+#define MP3_HEADER_XING_FLAG_TOC 0x04
+#define MP3_HEADER_XING_FLAG_QUALITY 0x08
+
+#define MP3_HEADER_LAME_TAG_SIZE 24 // Up to and including encoder delay and padding
+#define MP3_HEADER_LAME_DELAY_OFFSET 21
+
+#define MP3_HEADER_VBRI_OFFSET 36 // Always 32 bytes after frame header, regardless of side info size
+#define MP3_HEADER_VBRI_SIZE 26
+#define MP3_HEADER_VBRI_ENTRY_SIZE_MAX 4
+
+#define MP3_HEADER_TOC_SCALE 256
+
+static uint32_t read_be(const uint8_t *bytes, size_t size)
+{
+    uint32_t value = 0;
+    for (size_t i = 0; i < size; ++i) {
+        value = (value << 8) | bytes[i];
+    }
+    return value;
+}
+
+/* Checks whether frame header at given offset is followed by another one, to reject false syncs */
+static bool is_frame_confirmed(decoder_stream_t *stream, uint32_t offset, const mp3_frame_info_t *info)
+{
+    uint8_t bytes[MP3_HEADER_FRAME_HEADER_SIZE];
+    mp3_frame_info_t next_info;
+
+    if (decoder_stream_seek(stream, offset + info->frame_size, FS_SEEK_SET) != 0) {
+        return false;
+    }
+
+    const ssize_t bytes_read = decoder_stream_read(stream, bytes, sizeof(bytes));
+    if (bytes_read < (ssize_t)sizeof(bytes)) {
+        return true; // Single frame file
+    }
+
+    return mp3_header_parse_frame(bytes, &next_info) && (next_info.sample_rate == info->sample_rate);
+}
+
+static int find_first_frame(decoder_stream_t *stream, uint32_t *offset, mp3_frame_info_t *info, uint8_t *buffer)
+{
+    const uint32_t scan_end = *offset + MP3_HEADER_SYNC_SCAN_MAX;
+    uint32_t position = *offset;
+
+    while (position < scan_end) {
+        int err = decoder_stream_seek(stream, position, FS_SEEK_SET);
+        if (err) {
+            return err;
+        }
+
+        const ssize_t bytes_read = decoder_stream_read(stream, buffer, MP3_HEADER_BUFFER_SIZE);
+        if (bytes_read < MP3_HEADER_FRAME_HEADER_SIZE) {
+            return -ENODATA;
+        }
+
+        for (size_t i = 0; i <= (size_t)(bytes_read - MP3_HEADER_FRAME_HEADER_SIZE); ++i) {
+            if (mp3_header_parse_frame(&buffer[i], info) && is_frame_confirmed(stream, position + i, info)) {
+                *offset = position + i;
+                return 0;
+            }
+        }
+
+        /* Header might be split between reads */
+        position += bytes_read - (MP3_HEADER_FRAME_HEADER_SIZE - 1);
+    }
+
+    return -ENODATA;
+}
+
+static void parse_lame_tag(mp3_header_t *header, const uint8_t *tag, size_t size)
+{
+    /* ffmpeg writes tag in the same format */
+    if ((size < MP3_HEADER_LAME_TAG_SIZE) || ((memcmp(tag, "LAME", 4) != 0) && (memcmp(tag, "Lavc", 4) != 0) && (memcmp(tag, "Lavf", 4) != 0))) {
+        return;
+    }
+
+    const uint8_t *delay = &tag[MP3_HEADER_LAME_DELAY_OFFSET];
+    header->encoder_delay = (delay[0] << 4) | (delay[1] >> 4);
+    header->encoder_padding = ((delay[1] & 0x0F) << 8) | delay[2];
+    header->has_lame_tag = true;
+}
+
+static bool parse_xing(mp3_header_t *header, const uint8_t *buffer, size_t size, const mp3_frame_info_t *info)
+{
+    size_t pos = MP3_HEADER_FRAME_HEADER_SIZE + info->side_info_size;
+
+    /* "Info" is written by LAME for CBR files */
+    if (((pos + 8) > size) || ((memcmp(&buffer[pos], "Xing", 4) != 0) && (memcmp(&buffer[pos], "Info", 4) != 0))) {
+        return false;
+    }
+
+    const uint32_t flags = read_be(&buffer[pos + 4], 4);
+    pos += 8;
+
+    if ((flags & MP3_HEADER_XING_FLAG_FRAMES) && ((pos + 4) <= size)) {
+        header->frames = read_be(&buffer[pos], 4);
+        pos += 4;
+    }
+    if ((flags & MP3_HEADER_XING_FLAG_BYTES) && ((pos + 4) <= size)) {
+        header->bytes = read_be(&buffer[pos], 4);
+        pos += 4;
+    }
+    if ((flags & MP3_HEADER_XING_FLAG_TOC) && ((pos + MP3_HEADER_TOC_SIZE) <= size)) {
+        memcpy(header->toc, &buffer[pos], MP3_HEADER_TOC_SIZE);
+        header->has_toc = true;
+        pos += MP3_HEADER_TOC_SIZE;
+    }
+    if (flags & MP3_HEADER_XING_FLAG_QUALITY) {
+        pos += 4;
+    }
+
+    if (pos < size) {
+        parse_lame_tag(header, &buffer[pos], size - pos);
+    }
+
+    return true;
+}
+
+/* VBRI table holds size of each group of frames, convert it to Xing-like TOC to have single seek path */
+static int parse_vbri_toc(mp3_header_t *header, decoder_stream_t *stream, uint32_t offset, const uint8_t *vbri, uint8_t *buffer)
+{
+    const uint16_t entries = read_be(&vbri[18], 2);
+    const uint16_t scale = read_be(&vbri[20], 2);
+    const uint16_t entry_size = read_be(&vbri[22], 2);
+    const uint16_t frames_per_entry = read_be(&vbri[24], 2);
+
+    if ((entry_size == 0) || (entry_size > MP3_HEADER_VBRI_ENTRY_SIZE_MAX) || (frames_per_entry == 0) || (header->frames == 0) || (header->bytes == 0)) {
+        return -EINVAL;
+    }
+
+    int err = decoder_stream_seek(stream, offset, FS_SEEK_SET);
+    if (err) {
+        return err;
+    }
+
+    const size_t entries_per_read = MP3_HEADER_BUFFER_SIZE / entry_size;
+    size_t entries_buffered = 0;
+    size_t buffer_index = 0;
+    uint64_t position = 0; // Bytes covered by entries read so far
+    size_t percent = 0;
+
+    for (uint32_t entry = 0; entry <= entries; ++entry) {
+        /* Percents whose frame falls within entries read so far start at current position */
+        const uint64_t entry_frame = (uint64_t)entry * frames_per_entry;
+        while ((percent < MP3_HEADER_TOC_SIZE) && (((uint64_t)percent * header->frames) / MP3_HEADER_TOC_SIZE <= entry_frame)) {
+            header->toc[percent++] = MIN((position * MP3_HEADER_TOC_SCALE) / header->bytes, MP3_HEADER_TOC_SCALE - 1);
+        }
+
+        if ((entry == entries) || (percent == MP3_HEADER_TOC_SIZE)) {
+            break;
+        }
+
+        if (buffer_index == entries_buffered) {
+            const ssize_t bytes_read = decoder_stream_read(stream, buffer, entries_per_read * entry_size);
+            if (bytes_read < entry_size) {
+                return -EIO;
+            }
+            entries_buffered = bytes_read / entry_size;
+            buffer_index = 0;
+        }
+
+        position += (uint64_t)read_be(&buffer[buffer_index * entry_size], entry_size) * scale;
+        ++buffer_index;
+    }
+
+    /* Table shorter than stream */
+    while (percent < MP3_HEADER_TOC_SIZE) {
+        header->toc[percent++] = MP3_HEADER_TOC_SCALE - 1;
+    }
+
+    header->has_toc = true;
+
+    return 0;
+}
+
+static bool parse_vbri(mp3_header_t *header, decoder_stream_t *stream, uint8_t *buffer, size_t size)
+{
+    if (((MP3_HEADER_VBRI_OFFSET + MP3_HEADER_VBRI_SIZE) > size) || (memcmp(&buffer[MP3_HEADER_VBRI_OFFSET], "VBRI", 4) != 0)) {
+        return false;
+    }
+
+    uint8_t vbri[MP3_HEADER_VBRI_SIZE];
+    memcpy(vbri, &buffer[MP3_HEADER_VBRI_OFFSET], sizeof(vbri));
+
+    header->bytes = read_be(&vbri[10], 4);
+    header->frames = read_be(&vbri[14], 4);
+
+    /* Stream is still usable without TOC */
+    const uint32_t toc_offset = header->info_offset + MP3_HEADER_VBRI_OFFSET + MP3_HEADER_VBRI_SIZE;
+    parse_vbri_toc(header, stream, toc_offset, vbri, buffer);
+
+    return true;
+}
+
+int mp3_header_parse(mp3_header_t *header, decoder_stream_t *stream)
+{
+    uint8_t buffer[MP3_HEADER_BUFFER_SIZE];
+    mp3_frame_info_t info;
+
+    memset(header, 0, sizeof(*header));
+
+    const off_t start = decoder_stream_tell(stream);
+
+    /* Skip ID3v2 tag, its size is stored as syncsafe integer */
+    uint32_t offset = start;
+    ssize_t bytes_read = decoder_stream_read(stream, buffer, MP3_HEADER_ID3V2_HEADER_SIZE);
+    if ((bytes_read == MP3_HEADER_ID3V2_HEADER_SIZE) && (memcmp(buffer, "ID3", 3) == 0)) {
+        const uint32_t tag_size = ((buffer[6] & 0x7F) << 21) | ((buffer[7] & 0x7F) << 14) | ((buffer[8] & 0x7F) << 7) | (buffer[9] & 0x7F);
+        offset += MP3_HEADER_ID3V2_HEADER_SIZE + tag_size;
+        if (buffer[5] & MP3_HEADER_ID3V2_FOOTER_FLAG) {
+            offset += MP3_HEADER_ID3V2_FOOTER_SIZE;
+        }
+    }
+
+    int err = find_first_frame(stream, &offset, &info, buffer);
+    if (err) {
+        return err;
+    }
+
+    header->info_offset = offset;
+    header->audio_offset = offset;
+    header->sample_rate = info.sample_rate;
+    header->samples_per_frame = info.samples_per_frame;
+
+    err = decoder_stream_seek(stream, offset, FS_SEEK_SET);
+    if (err) {
+        return err;
+    }
+
+    bytes_read = decoder_stream_read(stream, buffer, sizeof(buffer));
+    if (bytes_read < MP3_HEADER_FRAME_HEADER_SIZE) {
+        return -EIO;
+    }
+
+    /* Frame holding VBR header carries no audio */
+    if (parse_xing(header, buffer, bytes_read, &info) || parse_vbri(header, stream, buffer, bytes_read)) {
+        header->audio_offset = offset + info.frame_size;
+    }
+
+    /* Size is needed to make use of TOC */
+    if (header->has_toc && (header->bytes == 0)) {
+        const off_t file_size = decoder_stream_get_size(stream);
+        if (file_size <= (off_t)offset) {
+            header->has_toc = false;
+        }
+        else {
+            header->bytes = file_size - offset;
+        }
+    }
+
+    return 0;
+}
+
+bool mp3_header_parse_frame(const uint8_t *bytes, mp3_frame_info_t *info)
+{
+    static const uint16_t bitrates_mpeg1[] = {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320};
+    static const uint16_t bitrates_mpeg2[] = {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160};
+    static const uint32_t sample_rates[] = {44100, 48000, 32000};
+
+    if ((bytes[0] != 0xFF) || ((bytes[1] & 0xE0) != 0xE0)) {
+        return false;
+    }
+
+    const uint8_t version = (bytes[1] >> 3) & 0x03; // 0 - MPEG2.5, 1 - reserved, 2 - MPEG2, 3 - MPEG1
+    const uint8_t layer = (bytes[1] >> 1) & 0x03; // 1 - Layer III
+    const uint8_t bitrate_index = bytes[2] >> 4;
+    const uint8_t sample_rate_index = (bytes[2] >> 2) & 0x03;
+    const uint8_t padding = (bytes[2] >> 1) & 0x01;
+    const bool mono = ((bytes[3] >> 6) == 0x03);
+
+    /* Free format bitrate is not supported */
+    if ((version == 1) || (layer != 1) || (bitrate_index == 0) || (bitrate_index == 0x0F) || (sample_rate_index == 0x03)) {
+        return false;
+    }
+
+    const bool mpeg1 = (version == 3);
+    const uint32_t bitrate = (mpeg1 ? bitrates_mpeg1 : bitrates_mpeg2)[bitrate_index] * 1000;
+
+    info->sample_rate = sample_rates[sample_rate_index] >> (mpeg1 ? 0 : (version == 2) ? 1 : 2);
+    info->samples_per_frame = mpeg1 ? 1152 : 576;
+    info->frame_size = ((info->samples_per_frame / 8) * bitrate) / info->sample_rate + padding;
+    info->side_info_size = mpeg1 ? (mono ? 17 : 32) : (mono ? 9 : 17);
+
+    return true;
+}
+
+uint32_t mp3_header_toc_lookup(const mp3_header_t *header, uint64_t position, uint64_t duration)
+{
+    if (!header->has_toc || (duration == 0)) {
+        return header->audio_offset;
+    }
+
+    /* Interpolate between neighbouring entries, percent has 8 fractional bits */
+    const uint64_t percent_max = (MP3_HEADER_TOC_SIZE << 8) - 1;
+    const uint64_t percent = MIN((position * (MP3_HEADER_TOC_SIZE << 8)) / duration, percent_max);
+    const size_t index = percent >> 8;
+    const int32_t fraction = percent & 0xFF;
+
+    const int32_t a = header->toc[index];
+    const int32_t b = ((index + 1) < MP3_HEADER_TOC_SIZE) ? header->toc[index + 1] : MP3_HEADER_TOC_SCALE;
+    const int32_t scaled = MAX((a << 8) + (b - a) * fraction, 0); // In 1/65536 of stream size
+
+    const uint32_t offset = header->info_offset + (uint32_t)(((uint64_t)scaled * header->bytes) >> 16);
+
+    return MAX(offset, header->audio_offset);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "decoder_stream.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define MP3_HEADER_TOC_SIZE 100
+#define MP3_HEADER_FRAME_HEADER_SIZE 4
+
+typedef struct
+{
+    uint32_t sample_rate;
+    uint32_t samples_per_frame;
+    uint32_t frame_size;
+    uint32_t side_info_size;
+} mp3_frame_info_t;
+
+/* Information gathered from ID3v2 tag and Xing/Info, VBRI and LAME headers at the beginning of the stream */
+typedef struct
+{
+    uint32_t info_offset; // First frame, holding VBR header if there is one; TOC is relative to it
+    uint32_t audio_offset; // First frame of actual audio
+    uint32_t sample_rate;
+    uint32_t samples_per_frame;
+    uint32_t frames; // Audio frames in stream, 0 if unknown
+    uint32_t bytes; // Stream size starting from info_offset, 0 if unknown
+    uint16_t encoder_delay; // From LAME tag, 0 if unknown
+    uint16_t encoder_padding;
+    bool has_lame_tag;
+    bool has_toc;
+    uint8_t toc[MP3_HEADER_TOC_SIZE]; // Position at each percent of duration, in 1/256 of bytes
+} mp3_header_t;
+
+/* Parses 4-byte MPEG Layer III frame header, returns false if it is not a valid one */
+bool mp3_header_parse_frame(const uint8_t *bytes, mp3_frame_info_t *info);
+
+/* Parses headers starting at current file position, leaves stream position undefined */
+int mp3_header_parse(mp3_header_t *header, decoder_stream_t *stream);
+
+/* Byte offset in file approximately corresponding to given fraction of duration, requires TOC */
+uint32_t mp3_header_toc_lookup(const mp3_header_t *header, uint64_t position, uint64_t duration);
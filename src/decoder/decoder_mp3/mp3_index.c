@@ -0,0 +1,84 @@
+#include "mp3_index.h"
+#include <zephyr/sys/util.h>
+
+#define MP3_INDEX_SECONDS_PER_HOUR 3600
+
+void mp3_index_init(mp3_index_t *index, uint32_t base_offset, uint32_t sample_rate)
+{
+    index->base_offset = base_offset;
+    index->sample_rate = sample_rate;
+    index->frontier_offset = base_offset;
+    index->frontier_frame = 0;
+    index->last_entry_offset = base_offset;
+    index->entries = 0;
+    index->complete = false;
+}
+
+bool mp3_index_extend(mp3_index_t *index, decoder_stream_t *stream, size_t frames_max)
+{
+    uint8_t bytes[MP3_HEADER_FRAME_HEADER_SIZE];
+    mp3_frame_info_t info;
+
+    for (size_t i = 0; (i < frames_max) && !index->complete; ++i) {
+        /* Record every n-th frame */
+        if ((index->frontier_frame > 0) && ((index->frontier_frame % MP3_INDEX_FRAMES_PER_ENTRY) == 0)) {
+            if (index->entries == MP3_INDEX_ENTRIES_MAX) {
+                index->complete = true;
+                break;
+            }
+            index->deltas[index->entries++] = index->frontier_offset - index->last_entry_offset;
+            index->last_entry_offset = index->frontier_offset;
+        }
+
+        /* Only header is needed, the rest of the frame is skipped */
+        if (decoder_stream_seek(stream, index->frontier_offset, FS_SEEK_SET) != 0) {
+            index->complete = true;
+            break;
+        }
+
+        const ssize_t bytes_read = decoder_stream_read(stream, bytes, sizeof(bytes));
+        if ((bytes_read < (ssize_t)sizeof(bytes)) || !mp3_header_parse_frame(bytes, &info) || (info.sample_rate != index->sample_rate)) {
+            index->complete = true; // End of stream or trailing tag
+            break;
+        }
+
+        index->frontier_offset += info.frame_size;
+        ++index->frontier_frame;
+    }
+
+    return !index->complete;
+}
+
+uint32_t mp3_index_lookup(const mp3_index_t *index, uint32_t frame, uint32_t *offset)
+{
+    const size_t entries = MIN(frame / MP3_INDEX_FRAMES_PER_ENTRY, index->entries);
+
+    *offset = index->base_offset;
+    for (size_t i = 0; i < entries; ++i) {
+        *offset += index->deltas[i];
+    }
+
+    return entries * MP3_INDEX_FRAMES_PER_ENTRY;
+}
+
+bool mp3_index_estimate(const mp3_index_t *index, uint32_t frame, uint32_t *offset)
+{
+    if (index->frontier_frame == 0) {
+        return false;
+    }
+
+    const uint64_t bytes_covered = index->frontier_offset - index->base_offset;
+    *offset = index->base_offset + (uint32_t)((bytes_covered * frame) / index->frontier_frame);
+
+    return true;
+}
+
+size_t mp3_index_get_bytes_per_hour(uint32_t sample_rate, uint32_t samples_per_frame)
+{
+    if (samples_per_frame == 0) {
+        return 0;
+    }
+
+    const size_t frames_per_hour = ((uint64_t)sample_rate * MP3_INDEX_SECONDS_PER_HOUR) / samples_per_frame;
+    return (frames_per_hour / MP3_INDEX_FRAMES_PER_ENTRY) * sizeof(uint16_t);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "mp3_header.h"
+#include "decoder_stream.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define MP3_INDEX_FRAMES_PER_ENTRY 32 // Groups of that many frames never exceed 64KB, even at 320kbps/32kHz
+#define MP3_INDEX_ENTRIES_MAX 2048 // About 28 minutes of 44.1kHz MPEG1 stream
+
+/* Byte offsets of every MP3_INDEX_FRAMES_PER_ENTRY-th frame, stored as deltas from the previous one */
+typedef struct
+{
+    uint32_t base_offset; // Offset of frame 0
+    uint32_t sample_rate;
+    uint32_t frontier_offset; // Next frame to be visited
+    uint32_t frontier_frame;
+    uint32_t last_entry_offset;
+    uint16_t entries;
+    bool complete; // End of stream, capacity or invalid frame reached
+    uint16_t deltas[MP3_INDEX_ENTRIES_MAX];
+} mp3_index_t;
+
+void mp3_index_init(mp3_index_t *index, uint32_t base_offset, uint32_t sample_rate);
+
+/* Walks up to frames_max frame headers from the frontier, returns false once index cannot grow anymore */
+bool mp3_index_extend(mp3_index_t *index, decoder_stream_t *stream, size_t frames_max);
+
+/* Returns the last indexed frame not after the given one and sets its byte offset */
+uint32_t mp3_index_lookup(const mp3_index_t *index, uint32_t frame, uint32_t *offset);
+
+/* Extrapolates byte offset of given frame from average frame size in indexed part, exact for CBR streams
+ * up to padding. Returns false if nothing has been indexed yet. */
+bool mp3_index_estimate(const mp3_index_t *index, uint32_t frame, uint32_t *offset);
+
+static inline uint32_t mp3_index_get_frames_covered(const mp3_index_t *index)
+{
+    return index->frontier_frame;
+}
+
+/* Memory needed to index an hour of stream */
+size_t mp3_index_get_bytes_per_hour(uint32_t sample_rate, uint32_t samples_per_frame);
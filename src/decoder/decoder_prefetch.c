@@ -0,0 +1,212 @@
+#include "decoder_prefetch.h"
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+#include <string.h>
+#include <errno.h>
+
+#define DECODER_PREFETCH_THREAD_STACK_SIZE (1024 * 3) // FatFs and SD card over SPI driver run on it, check with thread_analyzer.conf
+#define DECODER_PREFETCH_THREAD_PRIORITY 8 // Between player and decoder thread, starts reads while decoding, never delays feeding I2S
+
+typedef struct
+{
+	struct k_thread thread;
+	struct k_mutex lock; // Protects window state
+	struct k_mutex io_lock; // Held by prefetcher while it reads from the stream
+	struct k_sem wake; // Given by consumer when window needs attention
+	struct k_sem data_ready; // Given by prefetcher after each read
+	decoder_stream_t *stream;
+	bool positioned; // Window offset has been set by the first read after attaching
+	uint32_t generation; // Incremented whenever window is restarted, read in flight is then discarded
+	off_t window_offset; // File offset of the first byte in window
+	size_t head;
+	size_t fill;
+	bool eof;
+	int error;
+	decoder_prefetch_stats_t stats;
+	uint8_t __attribute__((aligned(4))) window[DECODER_PREFETCH_WINDOW_SIZE];
+} decoder_prefetch_ctx_t;
+
+static decoder_prefetch_ctx_t ctx;
+
+K_THREAD_STACK_DEFINE(prefetch_stack, DECODER_PREFETCH_THREAD_STACK_SIZE);
+
+/* Both have to be called with lock held */
+static void restart_window(off_t offset)
+{
+	ctx.window_offset = offset;
+	ctx.head = 0;
+	ctx.fill = 0;
+	ctx.eof = false;
+	ctx.error = 0;
+	++ctx.generation;
+}
+
+static void consume(size_t size)
+{
+	ctx.head = (ctx.head + size) % DECODER_PREFETCH_WINDOW_SIZE;
+	ctx.fill -= size;
+	ctx.window_offset += size;
+}
+
+static void prefetch_task(void *p1, void *p2, void *p3)
+{
+	ARG_UNUSED(p1);
+	ARG_UNUSED(p2);
+	ARG_UNUSED(p3);
+
+	while (1) {
+		k_mutex_lock(&ctx.lock, K_FOREVER);
+
+		const size_t space = DECODER_PREFETCH_WINDOW_SIZE - ctx.fill;
+		if ((ctx.stream == NULL) || !ctx.positioned || ctx.eof || (ctx.error != 0) || (space < DECODER_PREFETCH_REFILL_THRESHOLD)) {
+			k_mutex_unlock(&ctx.lock);
+			k_sem_take(&ctx.wake, K_FOREVER);
+			continue;
+		}
+
+		/* Read into free part of the window, consumer never touches it */
+		decoder_stream_t *stream = ctx.stream;
+		const uint32_t generation = ctx.generation;
+		const off_t offset = ctx.window_offset + ctx.fill;
+		const size_t tail = (ctx.head + ctx.fill) % DECODER_PREFETCH_WINDOW_SIZE;
+		const size_t size = MIN(MIN(space, DECODER_PREFETCH_WINDOW_SIZE - tail), DECODER_PREFETCH_CHUNK_SIZE);
+
+		k_mutex_lock(&ctx.io_lock, K_FOREVER);
+		k_mutex_unlock(&ctx.lock);
+
+		const ssize_t bytes_read = decoder_stream_file_read(stream, offset, &ctx.window[tail], size);
+
+		k_mutex_unlock(&ctx.io_lock);
+		k_mutex_lock(&ctx.lock, K_FOREVER);
+
+		if (generation == ctx.generation) {
+			if (bytes_read < 0) {
+				ctx.error = bytes_read;
+			}
+			else if (bytes_read == 0) {
+				ctx.eof = true;
+			}
+			else {
+				ctx.fill += bytes_read;
+				ctx.stats.bytes_prefetched += bytes_read;
+			}
+		}
+
+		k_mutex_unlock(&ctx.lock);
+		k_sem_give(&ctx.data_ready);
+	}
+}
+
+void decoder_prefetch_init(void)
+{
+	k_mutex_init(&ctx.lock);
+	k_mutex_init(&ctx.io_lock);
+	k_sem_init(&ctx.wake, 0, 1);
+	k_sem_init(&ctx.data_ready, 0, 1);
+
+	k_thread_create(&ctx.thread,
+					prefetch_stack,
+					K_THREAD_STACK_SIZEOF(prefetch_stack),
+					prefetch_task,
+					NULL,
+					NULL,
+					NULL,
+					DECODER_PREFETCH_THREAD_PRIORITY,
+					0,
+					K_NO_WAIT);
+	k_thread_name_set(&ctx.thread, "prefetch");
+}
+
+void decoder_prefetch_attach(decoder_stream_t *stream)
+{
+	k_mutex_lock(&ctx.lock, K_FOREVER);
+	if (ctx.stream != stream) {
+		ctx.stream = stream;
+		ctx.positioned = false;
+		restart_window(0);
+	}
+	k_mutex_unlock(&ctx.lock);
+}
+
+void decoder_prefetch_detach(decoder_stream_t *stream)
+{
+	k_mutex_lock(&ctx.lock, K_FOREVER);
+	if (ctx.stream != stream) {
+		k_mutex_unlock(&ctx.lock);
+		return;
+	}
+	ctx.stream = NULL;
+	restart_window(0);
+	k_mutex_unlock(&ctx.lock);
+
+	/* Wait for read in flight to finish */
+	k_mutex_lock(&ctx.io_lock, K_FOREVER);
+	k_mutex_unlock(&ctx.io_lock);
+}
+
+ssize_t decoder_prefetch_read(decoder_stream_t *stream, off_t offset, void *buffer, size_t size)
+{
+	uint8_t *bytes = buffer;
+	size_t bytes_read = 0;
+
+	k_mutex_lock(&ctx.lock, K_FOREVER);
+
+	if (ctx.stream != stream) {
+		k_mutex_unlock(&ctx.lock);
+		return -ENOENT;
+	}
+
+	/* Skipping forward within window is free, anything else restarts it at requested offset */
+	if (ctx.positioned && (offset >= ctx.window_offset) && (offset <= (ctx.window_offset + (off_t)ctx.fill))) {
+		consume(offset - ctx.window_offset);
+	}
+	else {
+		if (ctx.positioned) {
+			++ctx.stats.resets;
+		}
+		ctx.positioned = true;
+		restart_window(offset);
+	}
+
+	if (ctx.fill > 0) {
+		++ctx.stats.hits;
+	}
+	else {
+		++ctx.stats.stalls;
+	}
+
+	while (bytes_read < size) {
+		if (ctx.fill == 0) {
+			if (ctx.eof || (ctx.error != 0)) {
+				break;
+			}
+
+			k_mutex_unlock(&ctx.lock);
+			k_sem_give(&ctx.wake);
+			k_sem_take(&ctx.data_ready, K_FOREVER);
+			k_mutex_lock(&ctx.lock, K_FOREVER);
+			continue;
+		}
+
+		const size_t bytes_to_copy = MIN(size - bytes_read, MIN(ctx.fill, DECODER_PREFETCH_WINDOW_SIZE - ctx.head));
+		memcpy(&bytes[bytes_read], &ctx.window[ctx.head], bytes_to_copy);
+		consume(bytes_to_copy);
+		bytes_read += bytes_to_copy;
+	}
+
+	const int error = ctx.error;
+
+	k_mutex_unlock(&ctx.lock);
+
+	/* Space has been freed */
+	k_sem_give(&ctx.wake);
+
+	return ((bytes_read > 0) || (error == 0)) ? (ssize_t)bytes_read : error;
+}
+
+void decoder_prefetch_get_stats(decoder_prefetch_stats_t *stats)
+{
+	k_mutex_lock(&ctx.lock, K_FOREVER);
+	*stats = ctx.stats;
+	k_mutex_unlock(&ctx.lock);
+}
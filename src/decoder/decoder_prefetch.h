@@ -0,0 +1,30 @@
+#pragma once
+
+#include "decoder_stream.h"
+#include <stdint.h>
+#include <stddef.h>
+
+#define DECODER_PREFETCH_WINDOW_SIZE (1024 * 16) // Read-ahead kept in RAM for the attached stream
+#define DECODER_PREFETCH_REFILL_THRESHOLD (1024 * 4) // Free space in window that makes prefetcher read again
+#define DECODER_PREFETCH_CHUNK_SIZE (1024 * 4) // Largest single read issued by prefetcher
+
+typedef struct
+{
+	uint32_t hits; // Reads served from window without waiting, i.e. stalls avoided
+	uint32_t stalls; // Reads that had to wait for storage
+	uint32_t resets; // Window restarts caused by reads outside of it
+	uint32_t bytes_prefetched;
+} decoder_prefetch_stats_t;
+
+void decoder_prefetch_init(void);
+
+/* Only one stream is prefetched at a time, attaching another one replaces it */
+void decoder_prefetch_attach(decoder_stream_t *stream);
+
+/* Waits until prefetcher no longer uses the stream */
+void decoder_prefetch_detach(decoder_stream_t *stream);
+
+/* Reads through the window, returns -ENOENT if stream is not attached */
+ssize_t decoder_prefetch_read(decoder_stream_t *stream, off_t offset, void *buffer, size_t size);
+
+void decoder_prefetch_get_stats(decoder_prefetch_stats_t *stats);
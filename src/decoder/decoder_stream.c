@@ -0,0 +1,216 @@
+#include "decoder_stream.h"
+#include "decoder_prefetch.h"
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+#include <string.h>
+#include <errno.h>
+
+/* Streams are read by decoder, prefetch and player threads */
+typedef struct
+{
+	atomic_t requests;
+	atomic_t fs_reads;
+	atomic_t io_cycles;
+} decoder_stream_global_stats_t;
+
+static decoder_stream_global_stats_t global_stats;
+
+/* Zephyr builds FatFs without fast seek, so f_lseek follows cluster chain - from current cluster forward, from the
+ * start of file backward. Cluster link map would make it constant-time, but cannot be enabled in this build. */
+static int file_seek(decoder_stream_t *stream, off_t offset)
+{
+	if (stream->file_position == offset) {
+		return 0;
+	}
+
+	if (f_lseek(&stream->fil, offset) != FR_OK) {
+		return -EIO;
+	}
+
+	stream->file_position = offset;
+
+	return 0;
+}
+
+static ssize_t file_read(decoder_stream_t *stream, void *buffer, size_t size)
+{
+	UINT bytes_read;
+
+	atomic_inc(&global_stats.fs_reads);
+	if (f_read(&stream->fil, buffer, size, &bytes_read) != FR_OK) {
+		return -EIO;
+	}
+
+	stream->file_position += bytes_read;
+
+	return bytes_read;
+}
+
+/* Goes through prefetch window if stream is attached to it, time spent waiting is accounted either way */
+static ssize_t read_at(decoder_stream_t *stream, off_t offset, void *buffer, size_t size)
+{
+	const uint32_t start = k_cycle_get_32();
+
+	ssize_t bytes_read = decoder_prefetch_read(stream, offset, buffer, size);
+	if (bytes_read == -ENOENT) {
+		bytes_read = decoder_stream_file_read(stream, offset, buffer, size);
+	}
+
+	atomic_add(&global_stats.io_cycles, k_cycle_get_32() - start);
+
+	return bytes_read;
+}
+
+static ssize_t copy_from_buffer(decoder_stream_t *stream, void *buffer, size_t size)
+{
+	const off_t buffer_end = stream->buffer_offset + stream->buffer_fill;
+	if ((stream->position < stream->buffer_offset) || (stream->position >= buffer_end)) {
+		return 0;
+	}
+
+	const size_t index = stream->position - stream->buffer_offset;
+	const size_t bytes_to_copy = MIN(size, stream->buffer_fill - index);
+	memcpy(buffer, &stream->buffer[index], bytes_to_copy);
+	stream->position += bytes_to_copy;
+
+	return bytes_to_copy;
+}
+
+static int refill(decoder_stream_t *stream)
+{
+	const off_t offset = ROUND_DOWN(stream->position, DECODER_STREAM_BUFFER_SIZE);
+
+	stream->buffer_fill = 0;
+	stream->buffer_offset = offset;
+
+	const ssize_t bytes_read = read_at(stream, offset, stream->buffer, DECODER_STREAM_BUFFER_SIZE);
+	if (bytes_read < 0) {
+		return bytes_read;
+	}
+
+	stream->buffer_fill = bytes_read;
+
+	return 0;
+}
+
+int decoder_stream_open(decoder_stream_t *stream, const char *path)
+{
+	/* FatFs volume is named like its mount point, without the leading slash */
+	const FRESULT result = f_open(&stream->fil, (path[0] == '/') ? &path[1] : path, FA_READ);
+	if (result != FR_OK) {
+		return ((result == FR_NO_FILE) || (result == FR_NO_PATH)) ? -ENOENT : -EIO;
+	}
+
+	stream->size = f_size(&stream->fil);
+	stream->position = 0;
+	stream->file_position = 0;
+	stream->buffer_offset = 0;
+	stream->buffer_fill = 0;
+
+	return 0;
+}
+
+void decoder_stream_close(decoder_stream_t *stream)
+{
+	decoder_prefetch_detach(stream);
+	f_close(&stream->fil);
+}
+
+ssize_t decoder_stream_read(decoder_stream_t *stream, void *buffer, size_t size)
+{
+	uint8_t *bytes = buffer;
+	size_t bytes_read = 0;
+
+	atomic_inc(&global_stats.requests);
+
+	while (bytes_read < size) {
+		const size_t bytes_copied = copy_from_buffer(stream, &bytes[bytes_read], size - bytes_read);
+		if (bytes_copied > 0) {
+			bytes_read += bytes_copied;
+			continue;
+		}
+
+		/* Large aligned reads bypass the buffer */
+		const size_t bytes_left = size - bytes_read;
+		if (((stream->position % DECODER_STREAM_BUFFER_SIZE) == 0) && (bytes_left >= DECODER_STREAM_BUFFER_SIZE)) {
+			const ssize_t bytes_direct = read_at(stream, stream->position, &bytes[bytes_read], ROUND_DOWN(bytes_left, DECODER_STREAM_BUFFER_SIZE));
+			if (bytes_direct <= 0) {
+				return (bytes_read > 0) ? (ssize_t)bytes_read : bytes_direct;
+			}
+
+			bytes_read += bytes_direct;
+			stream->position += bytes_direct;
+			continue;
+		}
+
+		const int err = refill(stream);
+		if (err) {
+			return (bytes_read > 0) ? (ssize_t)bytes_read : err;
+		}
+
+		/* End of file */
+		if (stream->position >= (stream->buffer_offset + (off_t)stream->buffer_fill)) {
+			break;
+		}
+	}
+
+	return bytes_read;
+}
+
+int decoder_stream_seek(decoder_stream_t *stream, off_t offset, int whence)
+{
+	off_t position;
+
+	switch (whence) {
+		case FS_SEEK_SET:
+			position = offset;
+			break;
+
+		case FS_SEEK_CUR:
+			position = stream->position + offset;
+			break;
+
+		case FS_SEEK_END:
+			position = stream->size + offset;
+			break;
+
+		default:
+			return -EINVAL;
+	}
+
+	if ((position < 0) || (position > stream->size)) {
+		return -EINVAL;
+	}
+
+	/* Underlying file is moved only when data is actually needed */
+	stream->position = position;
+
+	return 0;
+}
+
+ssize_t decoder_stream_file_read(decoder_stream_t *stream, off_t offset, void *buffer, size_t size)
+{
+	const int err = file_seek(stream, offset);
+	if (err) {
+		return err;
+	}
+
+	return file_read(stream, buffer, size);
+}
+
+off_t decoder_stream_tell(const decoder_stream_t *stream)
+{
+	return stream->position;
+}
+
+off_t decoder_stream_get_size(const decoder_stream_t *stream)
+{
+	return stream->size;
+}
+
+void decoder_stream_get_stats(decoder_stream_stats_t *stats)
+{
+	stats->requests = atomic_get(&global_stats.requests);
+	stats->fs_reads = atomic_get(&global_stats.fs_reads);
+	stats->io_cycles = atomic_get(&global_stats.io_cycles);
+}
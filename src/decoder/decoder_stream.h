@@ -0,0 +1,44 @@
+#pragma once
+
+#include <zephyr/fs/fs.h>
+#include <ff.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define DECODER_STREAM_SECTOR_SIZE 512
+#define DECODER_STREAM_BUFFER_SIZE (DECODER_STREAM_SECTOR_SIZE * 4) // Divides cluster size, so buffer refills never span two clusters
+
+/* Buffered read-only file. Refills are aligned to buffer size, reads and seeks
+ * that fall within the buffer are served from RAM. */
+typedef struct
+{
+	FIL fil; // Opened through FatFs directly, bypassing VFS
+	off_t size;
+	off_t position; // Logical position, as seen by stream user
+	off_t file_position; // Position of underlying file
+	off_t buffer_offset; // File offset of the first byte in buffer
+	size_t buffer_fill;
+	uint8_t __attribute__((aligned(4))) buffer[DECODER_STREAM_BUFFER_SIZE];
+} decoder_stream_t;
+
+typedef struct
+{
+	uint32_t requests; // Reads issued by decoders
+	uint32_t fs_reads; // Reads that went to the filesystem
+	uint32_t io_cycles; // Time spent waiting for the filesystem
+} decoder_stream_stats_t;
+
+int decoder_stream_open(decoder_stream_t *stream, const char *path);
+void decoder_stream_close(decoder_stream_t *stream);
+
+ssize_t decoder_stream_read(decoder_stream_t *stream, void *buffer, size_t size);
+int decoder_stream_seek(decoder_stream_t *stream, off_t offset, int whence); // whence is one of FS_SEEK_*
+
+/* Unbuffered read at given offset, meant for prefetcher */
+ssize_t decoder_stream_file_read(decoder_stream_t *stream, off_t offset, void *buffer, size_t size);
+
+off_t decoder_stream_tell(const decoder_stream_t *stream);
+off_t decoder_stream_get_size(const decoder_stream_t *stream);
+
+/* Accumulated over all streams */
+void decoder_stream_get_stats(decoder_stream_stats_t *stats);
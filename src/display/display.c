@@ -7,31 +7,45 @@
 
 #include "display.h"
 #include <string.h>
-#include <stdlib.h>
 #include <errno.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <ssd1306_fonts.h>
 #include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
 
 /* Two-space suffix for scrolling to look good */
 #define DISPLAY_SUFFIX "  "
 #define DISPLAY_SUFFIX_LENGTH 2
 
+#define DISPLAY_LINE_BUFFER_SIZE (DISPLAY_TEXT_LENGTH_MAX + DISPLAY_SUFFIX_LENGTH + 1)
+#define DISPLAY_STRIP_SIZE ((DISPLAY_TEXT_LENGTH_MAX + DISPLAY_SUFFIX_LENGTH) * DISPLAY_FONT_WIDTH)
+#define DISPLAY_OFFSET_NONE SIZE_MAX // Line has not been drawn yet
+
+/* Each line is rendered once to a strip of columns, scrolling copies a window of it at a pixel offset */
 typedef struct 
 {
-	char *line_buffer[DISPLAY_LINES_NUM];
-	size_t line_offset[DISPLAY_LINES_NUM];
-	uint32_t scroll_delay[DISPLAY_LINES_NUM];
-	uint32_t last_refresh_tick[DISPLAY_LINES_NUM];
+	uint8_t strip[DISPLAY_LINES_NUM][DISPLAY_STRIP_SIZE];
+	size_t strip_width[DISPLAY_LINES_NUM]; // 0 if line has not been set
+	bool scroll[DISPLAY_LINES_NUM];
+	size_t line_offset[DISPLAY_LINES_NUM]; // In pixels, of the window currently drawn
+	uint32_t scroll_delay[DISPLAY_LINES_NUM]; // Time it takes to scroll by one char
+	uint32_t scroll_start_tick[DISPLAY_LINES_NUM];
 } display_ctx_t;
 
 static display_ctx_t ctx;
 
+/* Text longer than maximum is truncated */
+static size_t display_get_length(const char *text)
+{
+	return strnlen(text, DISPLAY_TEXT_LENGTH_MAX);
+}
+
 static bool display_only_one_not_fit(const char *lines_text[])
 {
 	bool found = false;
 	for (size_t line = 0; line < DISPLAY_LINES_NUM; ++line) {
-		if (strlen(lines_text[line]) > DISPLAY_LINE_LENGTH) {
+		if (display_get_length(lines_text[line]) > DISPLAY_LINE_LENGTH) {
 			if (found) {
 				return false;
 			}
@@ -45,7 +59,7 @@ static size_t display_get_max_length(const char *lines_text[])
 {
 	size_t max_length = 0;
 	for (size_t line = 0; line < DISPLAY_LINES_NUM; ++line) {
-		const size_t current_length = strlen(lines_text[line]);
+		const size_t current_length = display_get_length(lines_text[line]);
 		if (current_length > max_length) {
 			max_length = current_length;
 		}
@@ -53,9 +67,46 @@ static size_t display_get_max_length(const char *lines_text[])
 	return max_length;
 }
 
-static void display_gotoxy(size_t x, size_t y)
+/* Pads text with spaces to given length, appends suffix if it scrolls and renders it to line strip */
+static void display_fill_line(size_t line, const char *text, size_t length, size_t padded_length, bool scroll, uint32_t scroll_delay)
+{
+	char buffer[DISPLAY_LINE_BUFFER_SIZE];
+
+	memcpy(buffer, text, length);
+	memset(&buffer[length], ' ', padded_length - length);
+
+	if (scroll) {
+		memcpy(&buffer[padded_length], DISPLAY_SUFFIX, DISPLAY_SUFFIX_LENGTH + 1);
+	}
+	else {
+		buffer[padded_length] = '\0';
+	}
+
+	uint8_t *strip = ctx.strip[line];
+	size_t width = ssd1306_render_string(buffer, Font_6x8, SSD1306_WHITE, strip, DISPLAY_STRIP_SIZE);
+
+	/* Clear the rest of the display line, scrolling one could have been there before */
+	if (width < DISPLAY_WIDTH) {
+		memset(&strip[width], 0, DISPLAY_WIDTH - width);
+		width = DISPLAY_WIDTH;
+	}
+
+	ctx.strip_width[line] = width;
+	ctx.scroll[line] = scroll;
+	ctx.scroll_delay[line] = MAX(scroll_delay, 1);
+	ctx.line_offset[line] = DISPLAY_OFFSET_NONE;
+}
+
+/* Draws display width of strip starting at offset, wrapping around its end */
+static void display_draw_window(size_t line, size_t offset)
 {
-	ssd1306_set_cursor(y * DISPLAY_FONT_WIDTH, x * DISPLAY_FONT_HEIGHT);
+	const uint8_t *strip = ctx.strip[line];
+	const size_t head = MIN(ctx.strip_width[line] - offset, DISPLAY_WIDTH);
+
+	ssd1306_draw_columns(0, line * DISPLAY_FONT_HEIGHT, &strip[offset], head);
+	if (head < DISPLAY_WIDTH) {
+		ssd1306_draw_columns(head, line * DISPLAY_FONT_HEIGHT, strip, DISPLAY_WIDTH - head);
+	}
 }
 
 void display_init(void)
@@ -69,37 +120,16 @@ int display_set_text(const char *text, size_t line_num, uint32_t scroll_delay)
 		return -EINVAL;
 	}
 
-	free(ctx.line_buffer[line_num - 1]);
+	const size_t line_length = display_get_length(text);
 
-	const size_t line_length = strlen(text);
-	char *line;
-
-	/* Case without scrolling */
+	/* Pad fitting lines to display line length to clear previous chars, scroll the rest */
 	if (line_length <= DISPLAY_LINE_LENGTH) {
-		line = calloc(1, DISPLAY_LINE_LENGTH + 1);
-		if (line == NULL) {
-			return -ENOMEM;
-		}
-		memcpy(line, text, line_length);
-
-		const size_t padding = DISPLAY_LINE_LENGTH - line_length;
-		memset(&line[line_length], ' ', padding);
-		line[line_length + padding] = '\0';
+		display_fill_line(line_num - 1, text, line_length, DISPLAY_LINE_LENGTH, false, scroll_delay);
 	}
 	else {
-		line = calloc(1, line_length + DISPLAY_SUFFIX_LENGTH + 1);
-		if (line == NULL) {
-			return -ENOMEM;
-		}
-		memcpy(line, text, line_length);
-		memcpy(&line[line_length], DISPLAY_SUFFIX, DISPLAY_SUFFIX_LENGTH + 1);
+		display_fill_line(line_num - 1, text, line_length, line_length, true, scroll_delay);
 	}
 
-	ctx.line_buffer[line_num - 1] = line;
-	ctx.scroll_delay[line_num - 1] = scroll_delay;
-	ctx.line_offset[line_num - 1] = 0;
-	ctx.last_refresh_tick[line_num - 1] = 0;
-
 	return 0;
 }
 
@@ -120,39 +150,15 @@ int display_set_text_sync(const char *lines_text[], uint32_t scroll_delay)
 	/* Synchronized scrolling */
 	const size_t max_length = display_get_max_length(lines_text);
 	for (size_t line = 0; line < DISPLAY_LINES_NUM; ++line) {
-		/* Free previous buffer */
-		free(ctx.line_buffer[line]);
-
-		/* Create new buffer */
-		char *current_line = calloc(1, max_length + DISPLAY_SUFFIX_LENGTH + 1);
-		if (current_line == NULL) {
-			return -ENOMEM;
-		}
+		const size_t current_length = display_get_length(lines_text[line]);
 
-		/* Copy text to buffer */
-		const size_t current_length = strlen(lines_text[line]);
-		memcpy(current_line, lines_text[line], current_length);
-
-		/* Apply space padding */
+		/* Pad all fitting lines to display line length, all not fitting ones to the length of the longest one */
 		if (current_length <= DISPLAY_LINE_LENGTH) {
-			/* Pad all fitting lines to display line length to clear previous chars */
-			const size_t padding = DISPLAY_LINE_LENGTH - current_length;
-			memset(&current_line[current_length], ' ', padding);
+			display_fill_line(line, lines_text[line], current_length, DISPLAY_LINE_LENGTH, false, scroll_delay);
 		}
 		else {
-			/* Pad all not fitting lines to the length of the longest one */
-			const size_t padding = max_length - current_length;
-			memset(&current_line[current_length], ' ', padding);
-
-			/* Apply suffix */
-			memcpy(&current_line[max_length], DISPLAY_SUFFIX, DISPLAY_SUFFIX_LENGTH + 1);
+			display_fill_line(line, lines_text[line], current_length, max_length, true, scroll_delay);
 		}
-
-		/* Set line config in context */
-		ctx.line_buffer[line] = current_line;
-		ctx.scroll_delay[line] = scroll_delay;
-		ctx.line_offset[line] = 0;
-		ctx.last_refresh_tick[line] = 0;
 	}
 
 	return 0;
@@ -163,48 +169,34 @@ void display_task(void)
 	const uint32_t current_tick = k_uptime_get_32();
 
 	for (size_t line = 0; line < DISPLAY_LINES_NUM; ++line) {
-		/* Skip if no line buffer or line empty */
-		if ((ctx.line_buffer[line] == NULL) || (ctx.line_buffer[line][0] == '\0')) {
+		/* Skip if line not set */
+		if (ctx.strip_width[line] == 0) {
 			continue;
 		}
 
-		if ((current_tick - ctx.last_refresh_tick[line]) >= ctx.scroll_delay[line]) {
-			const size_t text_line_length = strlen(ctx.line_buffer[line]);
+		size_t offset = 0;
 
-			/* Display statically if it fits */
-			if (text_line_length <= DISPLAY_LINE_LENGTH) {
-				if (ctx.line_offset[line] > 0) {
-					continue;
-				}
-
-				display_gotoxy(line, 0);
-				ssd1306_write_string(ctx.line_buffer[line], Font_6x8, SSD1306_WHITE);
-				ssd1306_update_screen();
-				ctx.line_offset[line]++;
-			}
-			else {
-				/* Scroll if not */
-				char line_buffer[DISPLAY_LINE_LENGTH + 1];
-
-				for (size_t column = 0; column < DISPLAY_LINE_LENGTH; ++column) {
-					const size_t src_column = (ctx.line_offset[line] + column) % text_line_length;
-					line_buffer[column] = ctx.line_buffer[line][src_column];
-				}
-
-				display_gotoxy(line, 0);
-				ssd1306_write_string(line_buffer, Font_6x8, SSD1306_WHITE);
-				ssd1306_update_screen();
+		/* Lines set together start scrolling on the same tick, so synchronized ones stay aligned */
+		if (ctx.line_offset[line] == DISPLAY_OFFSET_NONE) {
+			ctx.scroll_start_tick[line] = current_tick;
+		}
+		else if (ctx.scroll[line]) {
+			const uint64_t elapsed = current_tick - ctx.scroll_start_tick[line];
+			offset = ((elapsed * DISPLAY_FONT_WIDTH) / ctx.scroll_delay[line]) % ctx.strip_width[line];
+		}
 
-				ctx.line_offset[line]++;
-				ctx.last_refresh_tick[line] = current_tick;
-			}
+		/* Static lines are drawn once, scrolling ones whenever they move by a pixel */
+		if (offset == ctx.line_offset[line]) {
+			continue;
 		}
+
+		display_draw_window(line, offset);
+		ssd1306_update_screen();
+		ctx.line_offset[line] = offset;
 	}
 }
 
 void display_deinit(void)
 {
-	for (size_t i = 0; i < DISPLAY_LINES_NUM; ++i) {
-		free(ctx.line_buffer[i]);
-	}
+	memset(&ctx, 0, sizeof(ctx));
 }
@@ -23,6 +23,8 @@
 #define DISPLAY_LINE_LENGTH (DISPLAY_WIDTH / DISPLAY_FONT_WIDTH)
 #define DISPLAY_LINES_NUM (DISPLAY_HEIGHT / DISPLAY_FONT_HEIGHT)
 
+#define DISPLAY_TEXT_LENGTH_MAX 255 // Fits any FAT long name, longer text is truncated
+
 void display_init(void);
 
 int display_set_text(const char *text, size_t line_num, uint32_t scroll_delay);
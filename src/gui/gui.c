@@ -15,12 +15,17 @@
 #include <zephyr/fs/fs.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
 
 #define GUI_BITRATE_VBR -1
 #define GUI_FRAMES_TO_ANALYZE_BITRATE 5
 #define GUI_MINS_PER_HOUR 60
+#define GUI_MS_PER_SEC 1000
 #define GUI_PLAYBACK_REFRESH_INTERVAL_MS 250
 #define GUI_VOLUME_VIEW_DISPLAY_TIME_MS 2000
+#define GUI_SEEK_STEP_S 5 // Seek done each time hold callback repeats
+#define GUI_LOADING_REFRESH_INTERVAL_MS 250
+#define GUI_JUMP_SETTLE_MS (KEYBOARD_HOLD_REPEAT_MS * 2) // Windowed listing is read once jumps stop repeating
 
 #define GUI_EMPTY_BAR_CHAR '-'
 #define GUI_FILLED_BAR_CHAR '#'
@@ -32,7 +37,8 @@ typedef enum
 {
 	GUI_VIEW_EXPLORER,
 	GUI_VIEW_PLAYBACK,
-	GUI_VIEW_VOLUME
+	GUI_VIEW_VOLUME,
+	GUI_VIEW_JUMP // Explorer with left and right jumping between leading letters
 } gui_view_t;
 
 typedef enum
@@ -45,13 +51,20 @@ typedef struct
 {
 	gui_view_t view;
 	dir_list_t *dirs;
-	dir_entry_t *current_dir;
-	dir_entry_t *last_playback_dir; // Stores entry that was played before leaving to explorer view
+	dir_cursor_t cursor;
+	dir_cursor_t last_playback_cursor; // Stores entry that was played before leaving to explorer view, invalid if none
+	bool loading; // Directory is being listed in background
+	size_t jump_bucket; // Leading letter cursor has jumped to
+	bool jump_pending; // Entries jumped to are not read yet
+	uint32_t last_jump_tick;
 	uint32_t last_refresh_tick; // Used to periodically refresh playback view
 	int8_t volume;
 	uint32_t last_volume_tick; // Used to return from volume view
 	uint32_t last_bitrate; // Used to determine whether current song is VBR
 	uint32_t frames_analyzed; // Frames analyzed by VBR detector
+	uint32_t track_duration_ms; // From library index, 0 if not indexed
+	uint32_t track_seq; // Used to detect player moving on to the next song by itself
+	struct k_mutex lock; // Keyboard callbacks run on system workqueue, listing and cursor are shared with GUI thread
 	struct k_thread gui_thread;
 } gui_ctx_t;
 
@@ -59,11 +72,6 @@ static gui_ctx_t ctx;
 
 K_THREAD_STACK_DEFINE(gui_stack, GUI_THREAD_STACK_SIZE);
 
-static bool is_directory(const struct fs_dirent *entry)
-{
-	return (entry->type == FS_DIR_ENTRY_DIR);
-}
-
 static uint32_t get_elapsed_time(void)
 {
 	const uint32_t pcm_sample_rate = player_get_pcm_sample_rate();
@@ -80,6 +88,11 @@ static int32_t get_total_time(size_t file_size)
 		return frames_total / player_get_pcm_sample_rate();
 	}
 
+	/* Index knows exact duration even for VBR files without header */
+	if (ctx.track_duration_ms > 0) {
+		return ctx.track_duration_ms / GUI_MS_PER_SEC;
+	}
+
 	/* If no total frames count info fallback to approximation algorithm */
 	const uint32_t current_bitrate = player_get_current_bitrate();
 	if (current_bitrate == 0) {
@@ -99,11 +112,43 @@ static int32_t get_total_time(size_t file_size)
 	return file_size / UTILS_KBITS_TO_BYTES(current_bitrate);
 }
 
+/* Keeps listing of directory being left in cache, along with cursor position. Returns the listing if it could not be
+ * cached, caller frees it once done with its entries. */
+static dir_list_t *leave_list(void)
+{
+	dir_list_t *uncached = NULL;
+	if (dir_cache_put(ctx.dirs, dir_cursor_get_index(&ctx.cursor)) != 0) {
+		uncached = ctx.dirs;
+	}
+
+	ctx.dirs = NULL;
+	dir_cursor_init(&ctx.cursor, NULL);
+
+	return uncached;
+}
+
 static void refresh_list(void)
 {
 	dir_list_free(ctx.dirs);
-	ctx.dirs = dir_list();
-	ctx.current_dir = ctx.dirs->head;
+	ctx.dirs = NULL;
+	dir_cursor_init(&ctx.cursor, NULL);
+
+	/* Recently visited directory is restored with its cursor position */
+	size_t cursor_index;
+	ctx.dirs = dir_cache_get(&cursor_index);
+	if (ctx.dirs != NULL) {
+		dir_scan_cancel();
+		dir_cursor_init(&ctx.cursor, ctx.dirs);
+		dir_cursor_jump(&ctx.cursor, cursor_index);
+		ctx.loading = false;
+		return;
+	}
+
+	/* Otherwise listing is done in background, starting it cancels the previous one */
+
+	dir_scan_set_throttle(player_get_state() == PLAYER_PLAYING);
+	dir_scan_start();
+	ctx.loading = true;
 }
 
 static void fill_bar_buffer(char *buffer, size_t items_to_fill, size_t items_total)
@@ -113,56 +158,133 @@ static void fill_bar_buffer(char *buffer, size_t items_to_fill, size_t items_tot
 	buffer[items_total] = '\0';
 }
 
-void start_playback(const char *filename)
+static char *get_song_path(const char *filename)
 {
+	if (filename == NULL) {
+		return NULL;
+	}
+
 	const char *const fs_path = dir_get_fs_path();
 	const size_t path_length = strlen(fs_path) + strlen(filename) + 2; // Additional '/' and null-teminator
 
 	char *path = calloc(1, path_length);
 	if (path == NULL) {
-		return;
+		return NULL;
 	}
 	snprintf(path, path_length, "%s/%s", fs_path, filename);
 
-	player_start(path);
-	player_set_volume(ctx.volume);
+	return path;
+}
+
+static void hint_next_song(void)
+{
+	/* Let player prepare next song in advance, unless this is the last one or it failed to be read */
+	dir_cursor_t next = ctx.cursor;
+	dir_cursor_next(&next);
+
+	const dir_entry_t *entry = dir_cursor_is_last(&ctx.cursor) ? NULL : dir_cursor_get_entry(&next);
+	if ((entry == NULL) || dir_entry_is_directory(entry)) {
+		player_set_next(NULL);
+		return;
+	}
+
+	char *path = get_song_path(dir_cursor_get_name(&next));
+	player_set_next(path);
+	free(path);
+}
+
+static void reset_song_info(void)
+{
 	ctx.frames_analyzed = 0;
 	ctx.last_bitrate = player_get_current_bitrate();
+	ctx.track_seq = player_get_track_seq();
+	ctx.track_duration_ms = dir_cursor_get_duration_ms(&ctx.cursor);
+}
+
+void start_playback(const char *filename)
+{
+	char *path = get_song_path(filename);
+	if (path == NULL) {
+		return;
+	}
+
+	player_start(path);
+	player_set_volume(ctx.volume);
+	reset_song_info();
+	hint_next_song();
 
 	free(path);
 }
 
+/* Returns true if player has moved on to the next song by itself */
+static bool follow_player(void)
+{
+	if (player_get_track_seq() == ctx.track_seq) {
+		return false;
+	}
+
+	dir_cursor_next(&ctx.cursor);
+	reset_song_info();
+	hint_next_song();
+
+	return true;
+}
+
 static void render_view_explorer(void)
 {
+	if (ctx.loading) {
+		char progress_line[DISPLAY_LINE_LENGTH + 1];
+		snprintf(progress_line, sizeof(progress_line), "%u entries", (unsigned int)dir_scan_get_progress());
+
+		display_set_text_sync((const char *[]){"Loading...", "", progress_line, ""}, GUI_SCROLL_DELAY_MS);
+		ctx.last_refresh_tick = k_uptime_get_32();
+		return;
+	}
+
 	/* Empty directory case */
-	if (ctx.current_dir == NULL) {
+	if (!dir_cursor_is_valid(&ctx.cursor)) {
 		display_set_text_sync((const char *[]){"Directory is empty!", "", "", ""}, GUI_SCROLL_DELAY_MS);
 		return;
 	}
 
 	const char *filenames[DISPLAY_LINES_NUM] = {"", "", "", ""};
-	dir_entry_t *current_dir = ctx.current_dir;
-
-	for (size_t line = 0; line < DISPLAY_LINES_NUM; ++line) {
-		const struct fs_dirent *entry = current_dir->data;
-		filenames[line] = entry->name;
+	const size_t lines = dir_cursor_fetch(&ctx.cursor, DISPLAY_LINES_NUM);
+	dir_cursor_t cursor = ctx.cursor;
 
-		current_dir = dir_get_next(ctx.dirs, current_dir);
-		if (current_dir == ctx.current_dir) {
-			break;
-		}
+	for (size_t line = 0; line < lines; ++line) {
+		filenames[line] = dir_cursor_get_name(&cursor);
+		dir_cursor_next(&cursor);
 	}
 
 	display_set_text_sync(filenames, GUI_SCROLL_DELAY_MS);
 }
 
+static void render_view_jump(void)
+{
+	char header_line[DISPLAY_LINE_LENGTH + 1];
+	snprintf(header_line, sizeof(header_line), "Jump to: < %c >", dir_prefix_get_label(ctx.jump_bucket));
+
+	const char *lines[DISPLAY_LINES_NUM] = {header_line, ctx.jump_pending ? "..." : "", "", ""};
+	const size_t count = ctx.jump_pending ? 0 : dir_cursor_fetch(&ctx.cursor, DISPLAY_LINES_NUM - 1);
+	dir_cursor_t cursor = ctx.cursor;
+
+	for (size_t line = 1; line <= count; ++line) {
+		lines[line] = dir_cursor_get_name(&cursor);
+		dir_cursor_next(&cursor);
+	}
+
+	display_set_text_sync(lines, GUI_SCROLL_DELAY_MS);
+}
+
 static void render_view_playback(gui_refresh_t refresh_mode)
 {
-	const struct fs_dirent *entry = ctx.current_dir->data;
+	/* Entry of windowed listing fails to be read on card error, total time is then unknown unless decoder knows it */
+	const dir_entry_t *entry = dir_cursor_get_entry(&ctx.cursor);
+	const char *name = (entry != NULL) ? dir_entry_get_name(ctx.cursor.list, entry) : "";
 
 	/* Compute elapsed and total time */
 	const uint32_t elapsed_time = get_elapsed_time();
-	const int32_t total_time = get_total_time(entry->size);
+	const int32_t total_time = get_total_time((entry != NULL) ? entry->size : 0);
 
 	/* Prepare bottom line of the view in buffer */
 	size_t offset;
@@ -190,7 +312,7 @@ static void render_view_playback(gui_refresh_t refresh_mode)
 
 	switch (refresh_mode) {
 		case GUI_REFRESH_ALL:
-			display_set_text_sync((const char *[]){entry->name, "", progress_bar_buffer, info_line_buffer}, GUI_SCROLL_DELAY_MS);
+			display_set_text_sync((const char *[]){name, "", progress_bar_buffer, info_line_buffer}, GUI_SCROLL_DELAY_MS);
 			break;
 
 		case GUI_REFRESH_TIME:
@@ -218,55 +340,84 @@ static void render_view_volume(void)
 	ctx.last_volume_tick = k_uptime_get_32();
 }
 
+/* Prefix table of listing makes it constant-time, without reading the card. Entries of windowed listing
+ * are shown only after jumping stops, so that holding the button does not rescan directory on every repeat. */
+static void jump_letter(bool forward)
+{
+	if (ctx.loading || !dir_cursor_is_valid(&ctx.cursor)) {
+		return;
+	}
+
+	ctx.jump_bucket = dir_cursor_jump_bucket(&ctx.cursor, forward);
+	ctx.jump_pending = dir_cursor_fetch_needs_scan(&ctx.cursor, DISPLAY_LINES_NUM - 1);
+	ctx.last_jump_tick = k_uptime_get_32();
+	ctx.view = GUI_VIEW_JUMP;
+	render_view_jump();
+}
+
 static void callback_up(void)
 {
+	k_mutex_lock(&ctx.lock, K_FOREVER);
+
 	switch (ctx.view) {
+		case GUI_VIEW_JUMP:
 		case GUI_VIEW_EXPLORER:
-			ctx.current_dir = dir_get_prev(ctx.dirs, ctx.current_dir);
+			ctx.view = GUI_VIEW_EXPLORER;
+			dir_cursor_prev(&ctx.cursor);
 			render_view_explorer();
 			break;
 
 		case GUI_VIEW_PLAYBACK: {
-			ctx.current_dir = dir_get_prev(ctx.dirs, ctx.current_dir);
-			const struct fs_dirent *entry = ctx.current_dir->data;
-			start_playback(entry->name);
+			dir_cursor_prev(&ctx.cursor);
+			start_playback(dir_cursor_get_name(&ctx.cursor));
 			render_view_playback(GUI_REFRESH_ALL);
 		} break;
 
 		default:
 			break;
 	}
+
+	k_mutex_unlock(&ctx.lock);
 }
 
 static void callback_down(void)
 {
+	k_mutex_lock(&ctx.lock, K_FOREVER);
+
 	switch (ctx.view) {
+		case GUI_VIEW_JUMP:
 		case GUI_VIEW_EXPLORER:
-			ctx.current_dir = dir_get_next(ctx.dirs, ctx.current_dir);
+			ctx.view = GUI_VIEW_EXPLORER;
+			dir_cursor_next(&ctx.cursor);
 			render_view_explorer();
 			break;
 
 		case GUI_VIEW_PLAYBACK: {
-			ctx.current_dir = dir_get_next(ctx.dirs, ctx.current_dir);
-			const struct fs_dirent *entry = ctx.current_dir->data;
-			start_playback(entry->name);
+			dir_cursor_next(&ctx.cursor);
+			start_playback(dir_cursor_get_name(&ctx.cursor));
 			render_view_playback(GUI_REFRESH_ALL);
 		} break;
 
 		default:
 			break;
 	}
+
+	k_mutex_unlock(&ctx.lock);
 }
 
 static void callback_left(void)
 {
+	k_mutex_lock(&ctx.lock, K_FOREVER);
+
 	switch (ctx.view) {
 		case GUI_VIEW_EXPLORER:
+			/* If already in root, the same listing comes back from cache */
+			dir_list_free(leave_list());
 			if (dir_return() == 0) {
-				ctx.last_playback_dir = NULL;
-				refresh_list();
-				render_view_explorer();
+				dir_cursor_init(&ctx.last_playback_cursor, NULL);
 			}
+			refresh_list();
+			render_view_explorer();
 			break;
 
 		case GUI_VIEW_PLAYBACK:
@@ -278,7 +429,7 @@ static void callback_left(void)
 				ctx.view = GUI_VIEW_VOLUME;
 			}
 			else {
-				ctx.last_playback_dir = ctx.current_dir;
+				ctx.last_playback_cursor = ctx.cursor;
 				ctx.view = GUI_VIEW_EXPLORER;
 				render_view_explorer();
 			}
@@ -291,17 +442,25 @@ static void callback_left(void)
 			render_view_volume();
 			break;
 
+		case GUI_VIEW_JUMP:
+			jump_letter(false);
+			break;
+
 		default:
 			break;
 	}
+
+	k_mutex_unlock(&ctx.lock);
 }
 
 static void callback_right(void)
 {
+	k_mutex_lock(&ctx.lock, K_FOREVER);
+
 	switch (ctx.view) {
 		case GUI_VIEW_EXPLORER:
-			if ((player_get_state() == PLAYER_PAUSED) && (ctx.last_playback_dir != NULL)) {
-				ctx.current_dir = ctx.last_playback_dir;
+			if ((player_get_state() == PLAYER_PAUSED) && dir_cursor_is_valid(&ctx.last_playback_cursor)) {
+				ctx.cursor = ctx.last_playback_cursor;
 				render_view_playback(GUI_REFRESH_ALL);
 				ctx.view = GUI_VIEW_PLAYBACK;
 			}
@@ -324,31 +483,133 @@ static void callback_right(void)
 			render_view_volume();
 			break;
 
+		case GUI_VIEW_JUMP:
+			jump_letter(true);
+			break;
+
 		default:
 			break;
 	}
+
+	k_mutex_unlock(&ctx.lock);
+}
+
+static void seek(int32_t step_s)
+{
+	const uint32_t pcm_sample_rate = player_get_pcm_sample_rate();
+	if (pcm_sample_rate == 0) {
+		return;
+	}
+
+	player_seek_relative(step_s * (int32_t)pcm_sample_rate);
+	render_view_playback(GUI_REFRESH_TIME);
+}
+
+static void callback_left_hold(void)
+{
+	k_mutex_lock(&ctx.lock, K_FOREVER);
+
+	switch (ctx.view) {
+		case GUI_VIEW_PLAYBACK:
+			seek(-GUI_SEEK_STEP_S);
+			break;
+
+		case GUI_VIEW_VOLUME:
+			callback_left();
+			break;
+
+		case GUI_VIEW_EXPLORER:
+		case GUI_VIEW_JUMP:
+			jump_letter(false);
+			break;
+
+		default:
+			break;
+	}
+
+	k_mutex_unlock(&ctx.lock);
+}
+
+static void callback_right_hold(void)
+{
+	k_mutex_lock(&ctx.lock, K_FOREVER);
+
+	switch (ctx.view) {
+		case GUI_VIEW_PLAYBACK:
+			seek(GUI_SEEK_STEP_S);
+			break;
+
+		case GUI_VIEW_VOLUME:
+			callback_right();
+			break;
+
+		case GUI_VIEW_EXPLORER:
+		case GUI_VIEW_JUMP:
+			jump_letter(true);
+			break;
+
+		default:
+			break;
+	}
+
+	k_mutex_unlock(&ctx.lock);
+}
+
+static void callback_up_hold(void)
+{
+	k_mutex_lock(&ctx.lock, K_FOREVER);
+
+	if ((ctx.view == GUI_VIEW_EXPLORER) || (ctx.view == GUI_VIEW_JUMP)) {
+		ctx.view = GUI_VIEW_EXPLORER;
+		dir_cursor_move(&ctx.cursor, -DISPLAY_LINES_NUM);
+		render_view_explorer();
+	}
+
+	k_mutex_unlock(&ctx.lock);
+}
+
+static void callback_down_hold(void)
+{
+	k_mutex_lock(&ctx.lock, K_FOREVER);
+
+	if ((ctx.view == GUI_VIEW_EXPLORER) || (ctx.view == GUI_VIEW_JUMP)) {
+		ctx.view = GUI_VIEW_EXPLORER;
+		dir_cursor_move(&ctx.cursor, DISPLAY_LINES_NUM);
+		render_view_explorer();
+	}
+
+	k_mutex_unlock(&ctx.lock);
 }
 
 static void callback_enter(void)
 {
+	k_mutex_lock(&ctx.lock, K_FOREVER);
+
 	switch (ctx.view) {
 		case GUI_VIEW_EXPLORER: {
 			/* Empty directory case */
-			if (ctx.current_dir == NULL) {
+			if (!dir_cursor_is_valid(&ctx.cursor)) {
 				break;
 			}
 
-			const struct fs_dirent *entry = ctx.current_dir->data;
-			if (is_directory(entry)) {
-				/* Get inside the directory */
-				if (dir_enter(entry->name) == 0) {
-					ctx.last_playback_dir = NULL;
-					refresh_list();
-					render_view_explorer();
+			const dir_entry_t *entry = dir_cursor_get_entry(&ctx.cursor);
+			if (entry == NULL) {
+				break; // Failed to be read, nothing to enter or play
+			}
+
+			if (dir_entry_is_directory(entry)) {
+				/* Get inside the directory, name stays valid as the most recently cached listing is never evicted, and listing that failed to be cached is freed after entering */
+				const char *name = dir_cursor_get_name(&ctx.cursor);
+				dir_list_t *uncached = leave_list();
+				if (dir_enter(name) == 0) {
+					dir_cursor_init(&ctx.last_playback_cursor, NULL);
 				}
+				dir_list_free(uncached);
+				refresh_list();
+				render_view_explorer();
 			}
 			else {
-				start_playback(entry->name);
+				start_playback(dir_cursor_get_name(&ctx.cursor));
 				render_view_playback(GUI_REFRESH_ALL);
 				ctx.view = GUI_VIEW_PLAYBACK;
 			}
@@ -364,9 +625,40 @@ static void callback_enter(void)
 			}
 		} break;
 
+		case GUI_VIEW_JUMP:
+			/* Stay at the letter jumped to */
+			ctx.view = GUI_VIEW_EXPLORER;
+			render_view_explorer();
+			break;
+
 		default:
 			break;
 	}
+
+	k_mutex_unlock(&ctx.lock);
+}
+
+/* Called under lock, so that result cannot belong to a scan a key press has already replaced */
+static void poll_list(uint32_t current_tick)
+{
+	dir_list_t *list;
+	const int ret = dir_scan_get_result(&list);
+	if (ret == -EBUSY) {
+		if ((current_tick - ctx.last_refresh_tick) > GUI_LOADING_REFRESH_INTERVAL_MS) {
+			render_view_explorer();
+		}
+	}
+	else if (ctx.loading) {
+		if (ret == 0) {
+			ctx.dirs = list;
+			dir_cursor_init(&ctx.cursor, ctx.dirs);
+		}
+		ctx.loading = false;
+		render_view_explorer();
+	}
+	else if (ret == 0) {
+		dir_list_free(list);
+	}
 }
 
 /* It's VERY BAD that it's here, but I had no better idea... */
@@ -374,7 +666,16 @@ static void refresh_task(void)
 {
 	const uint32_t current_tick = k_uptime_get_32();
 
+	/* Rendering reads windows of listing, which keyboard callbacks move as well */
+	k_mutex_lock(&ctx.lock, K_FOREVER);
+
 	switch (ctx.view) {
+		case GUI_VIEW_EXPLORER:
+			if (ctx.loading) {
+				poll_list(current_tick);
+			}
+			break;
+
 		case GUI_VIEW_PLAYBACK: {
 			/* Refresh playback elapsed time */
 			if ((current_tick - ctx.last_refresh_tick) > GUI_PLAYBACK_REFRESH_INTERVAL_MS) {
@@ -382,20 +683,30 @@ static void refresh_task(void)
 				ctx.last_refresh_tick = current_tick;
 			}
 
-			/* Check if next song should be played */
-			const dir_entry_t *first_dir = ctx.dirs->head;
-			dir_entry_t *next_dir = dir_get_next(ctx.dirs, ctx.current_dir);
+			/* Check if player continued with the next song */
+			if (follow_player()) {
+				render_view_playback(GUI_REFRESH_ALL);
+				break;
+			}
 
-			if ((player_get_state() == PLAYER_STOPPED) && (first_dir != next_dir)) {
-				ctx.current_dir = next_dir;
+			/* Check if next song should be played */
+			if ((player_get_state() == PLAYER_STOPPED) && !dir_cursor_is_last(&ctx.cursor)) {
+				dir_cursor_next(&ctx.cursor);
 
-				const struct fs_dirent *entry = ctx.current_dir->data;
-				start_playback(entry->name);
+				start_playback(dir_cursor_get_name(&ctx.cursor));
 				render_view_playback(GUI_REFRESH_ALL);
 			}
 		} break;
 
+		case GUI_VIEW_JUMP:
+			if (ctx.jump_pending && ((current_tick - ctx.last_jump_tick) > GUI_JUMP_SETTLE_MS)) {
+				ctx.jump_pending = false;
+				render_view_jump();
+			}
+			break;
+
 		case GUI_VIEW_VOLUME:
+			follow_player();
 			if ((current_tick - ctx.last_volume_tick) > GUI_VOLUME_VIEW_DISPLAY_TIME_MS) {
 				render_view_playback(GUI_REFRESH_ALL);
 				ctx.view = GUI_VIEW_PLAYBACK;
@@ -405,6 +716,8 @@ static void refresh_task(void)
 		default:
 			break;
 	}
+
+	k_mutex_unlock(&ctx.lock);
 }
 
 static void gui_task(void *p1, void *p2, void *p3)
@@ -423,6 +736,12 @@ static void gui_task(void *p1, void *p2, void *p3)
 	keyboard_attach_callback(KEYBOARD_LEFT, callback_left);
 	keyboard_attach_callback(KEYBOARD_RIGHT, callback_right);
 	keyboard_attach_callback(KEYBOARD_ENTER, callback_enter);
+	keyboard_attach_hold_callback(KEYBOARD_UP, callback_up_hold);
+	keyboard_attach_hold_callback(KEYBOARD_DOWN, callback_down_hold);
+	keyboard_attach_hold_callback(KEYBOARD_LEFT, callback_left_hold);
+	keyboard_attach_hold_callback(KEYBOARD_RIGHT, callback_right_hold);
+
+	k_mutex_lock(&ctx.lock, K_FOREVER);
 
 	/* Get initial directory listing */
 	refresh_list();
@@ -433,6 +752,8 @@ static void gui_task(void *p1, void *p2, void *p3)
 	/* Set default view and render it */
 	ctx.view = GUI_VIEW_EXPLORER;
 	render_view_explorer();
+
+	k_mutex_unlock(&ctx.lock);
 	
 	/* Run main loop */
 	while (1) {
@@ -444,6 +765,8 @@ static void gui_task(void *p1, void *p2, void *p3)
 
 void gui_init(void)
 {
+	k_mutex_init(&ctx.lock);
+
 	k_thread_create(&ctx.gui_thread,
 					gui_stack,
 					K_THREAD_STACK_SIZEOF(gui_stack),
@@ -454,6 +777,7 @@ void gui_init(void)
 					GUI_THREAD_PRIORITY,
 					0,
 					K_NO_WAIT);
+	k_thread_name_set(&ctx.gui_thread, "gui");
 }
 
 // void gui_deinit(void)
@@ -8,7 +8,7 @@ LOG_MODULE_REGISTER(keyboard);
 typedef struct
 {
     struct k_work_delayable work;
-    uint32_t pending_pins_mask;
+    atomic_t pending_pins_mask;
 } keyboard_delayed_work_t;
 
 typedef struct
@@ -22,6 +22,10 @@ typedef struct
     struct gpio_callback callback_data;
     keyboard_delayed_work_t button_work;
     keyboard_callback_t button_callbacks[KEYBOARD_BUTTONS_COUNT];
+    keyboard_callback_t hold_callbacks[KEYBOARD_BUTTONS_COUNT];
+    struct k_work_delayable hold_work;
+    const keyboard_gpio_map_t *held_entry; // Button with hold callback being pressed, NULL if none
+    bool hold_reported;
 } keyboard_ctx_t;
 
 static keyboard_ctx_t ctx;
@@ -44,26 +48,76 @@ inline static bool is_pin_pending(const struct gpio_dt_spec *gpio, uint32_t mask
     return ((mask & BIT(gpio->pin)) != 0);
 }
 
+static void keyboard_press(const keyboard_gpio_map_t *entry)
+{
+    /* Wait to see whether it is going to be held */
+    if (ctx.hold_callbacks[entry->button] != NULL) {
+        ctx.held_entry = entry;
+        ctx.hold_reported = false;
+        k_work_reschedule(&ctx.hold_work, K_MSEC(KEYBOARD_HOLD_DELAY_MS));
+        return;
+    }
+
+    if (ctx.button_callbacks[entry->button] != NULL) {
+        ctx.button_callbacks[entry->button]();
+    }
+}
+
+static void keyboard_release(const keyboard_gpio_map_t *entry)
+{
+    if (ctx.held_entry != entry) {
+        return;
+    }
+
+    k_work_cancel_delayable(&ctx.hold_work);
+    ctx.held_entry = NULL;
+
+    /* Released before hold delay elapsed - it was a short press */
+    if (!ctx.hold_reported && (ctx.button_callbacks[entry->button] != NULL)) {
+        ctx.button_callbacks[entry->button]();
+    }
+}
+
 static void keyboard_gpio_handler(struct k_work *work)
 {
     struct k_work_delayable *dwork = k_work_delayable_from_work(work);
-    const keyboard_delayed_work_t *item = CONTAINER_OF(dwork, keyboard_delayed_work_t, work);
+    keyboard_delayed_work_t *item = CONTAINER_OF(dwork, keyboard_delayed_work_t, work);
+    const uint32_t pending_pins_mask = atomic_clear(&item->pending_pins_mask);
 
     for (size_t i = 0; i < ARRAY_SIZE(gpio_map); ++i) {
         const keyboard_gpio_map_t *entry = &gpio_map[i];
-        if (is_pin_pending(&entry->gpio, item->pending_pins_mask) && is_pin_active(&entry->gpio)) {
-            if (ctx.button_callbacks[entry->button] != NULL) {
-                ctx.button_callbacks[entry->button]();
-            }
+        if (!is_pin_pending(&entry->gpio, pending_pins_mask)) {
+            continue;
+        }
+
+        if (is_pin_active(&entry->gpio)) {
+            keyboard_press(entry);
+        }
+        else {
+            keyboard_release(entry);
         }
     }
 }
 
+static void keyboard_hold_handler(struct k_work *work)
+{
+    ARG_UNUSED(work);
+
+    const keyboard_gpio_map_t *entry = ctx.held_entry;
+    if ((entry == NULL) || !is_pin_active(&entry->gpio)) {
+        return;
+    }
+
+    ctx.hold_reported = true;
+    ctx.hold_callbacks[entry->button]();
+    k_work_reschedule(&ctx.hold_work, K_MSEC(KEYBOARD_HOLD_REPEAT_MS));
+}
+
 static void keyboard_button_callback(const struct device *dev, struct gpio_callback *cb, uint32_t pins)
 {
     ARG_UNUSED(cb);
 
-    ctx.button_work.pending_pins_mask = pins;
+    atomic_or(&ctx.button_work.pending_pins_mask, pins);
     k_work_reschedule(&ctx.button_work.work, K_MSEC(KEYBOARD_DEBOUNCE_TIME_MS));
 }
 
@@ -85,7 +139,7 @@ int keyboard_init(void)
             return status;
         }
 
-        status = gpio_pin_interrupt_configure_dt(&gpio_map[i].gpio, GPIO_INT_EDGE_FALLING);
+        status = gpio_pin_interrupt_configure_dt(&gpio_map[i].gpio, GPIO_INT_EDGE_BOTH);
         if (status < 0) {
             LOG_ERR("Failed to configure GPIO pin interrupt, error: %d", status);
             return status;
@@ -102,6 +156,7 @@ int keyboard_init(void)
     }
 
     k_work_init_delayable(&ctx.button_work.work, keyboard_gpio_handler);
+    k_work_init_delayable(&ctx.hold_work, keyboard_hold_handler);
 
     return 0;
 }
@@ -114,3 +169,12 @@ void keyboard_attach_callback(keyboard_button_t button, keyboard_callback_t call
 
     ctx.button_callbacks[button] = callback;
 }
+
+void keyboard_attach_hold_callback(keyboard_button_t button, keyboard_callback_t callback)
+{
+    if ((button < 0) || (button >= KEYBOARD_BUTTONS_COUNT)) {
+        return;
+    }
+
+    ctx.hold_callbacks[button] = callback;
+}
@@ -1,6 +1,8 @@
 #pragma once
 
 #define KEYBOARD_DEBOUNCE_TIME_MS 50
+#define KEYBOARD_HOLD_DELAY_MS 500 // Time after which pressed button is considered held
+#define KEYBOARD_HOLD_REPEAT_MS 200 // Interval of repeating hold callback while button is held
 
 typedef enum 
 {
@@ -16,3 +18,5 @@ typedef void (*keyboard_callback_t)(void);
 
 int keyboard_init(void);
 void keyboard_attach_callback(keyboard_button_t button, keyboard_callback_t callback);
+/* Buttons with hold callback report short press on release, so that it can be told apart from hold */
+void keyboard_attach_hold_callback(keyboard_button_t button, keyboard_callback_t callback);
@@ -5,6 +5,7 @@
 #include <ff.h>
 #include <gui.h>
 #include <dir.h>
+#include <library.h>
 #include <player.h>
 #include <ssd1306.h>
 #include <ssd1306_fonts.h>
@@ -36,6 +37,9 @@ int main(void)
 	/* Initialize dir */
 	dir_init(SD_MOUNT_POINT);
 
+	/* Open library index, directories are listed from card if there's none */
+	library_init(SD_MOUNT_POINT);
+
 	/* Start player thread */
 	player_init();
 
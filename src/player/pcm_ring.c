@@ -0,0 +1,49 @@
+#include "pcm_ring.h"
+#include <errno.h>
+
+BUILD_ASSERT((PCM_RING_SLOTS & (PCM_RING_SLOTS - 1)) == 0, "PCM_RING_SLOTS must be a power of two");
+
+#define PCM_RING_MASK (PCM_RING_SLOTS - 1)
+
+void pcm_ring_init(pcm_ring_t *ring)
+{
+    atomic_set(&ring->head, 0);
+    atomic_set(&ring->tail, 0);
+    k_sem_init(&ring->available, 0, PCM_RING_SLOTS);
+}
+
+int pcm_ring_push(pcm_ring_t *ring, void *block, size_t frames, int32_t track_start)
+{
+    const atomic_val_t head = atomic_get(&ring->head);
+    const atomic_val_t tail = atomic_get(&ring->tail);
+
+    if ((head - tail) >= PCM_RING_SLOTS) {
+        return -ENOSPC;
+    }
+
+    ring->items[head & PCM_RING_MASK].block = block;
+    ring->items[head & PCM_RING_MASK].frames = frames;
+    ring->items[head & PCM_RING_MASK].track_start = track_start;
+
+    /* Publish item only after it has been filled */
+    atomic_set(&ring->head, head + 1);
+    k_sem_give(&ring->available);
+
+    return 0;
+}
+
+int pcm_ring_pop(pcm_ring_t *ring, pcm_ring_item_t *item, k_timeout_t timeout)
+{
+    const int err = k_sem_take(&ring->available, timeout);
+    if (err) {
+        return err;
+    }
+
+    const atomic_val_t tail = atomic_get(&ring->tail);
+    *item = ring->items[tail & PCM_RING_MASK];
+
+    /* Release slot only after item has been copied out */
+    atomic_set(&ring->tail, tail + 1);
+
+    return 0;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <zephyr/kernel.h>
+#include <stddef.h>
+
+#define PCM_RING_SLOTS 16 // Must be a power of two
+
+#define PCM_RING_NO_TRACK_START -1
+
+typedef struct
+{
+    void *block; // NULL marks end of stream
+    size_t frames;
+    int32_t track_start; // Frame in block where next track begins, PCM_RING_NO_TRACK_START if none
+} pcm_ring_item_t;
+
+/* Single-producer/single-consumer queue of decoded PCM blocks. Indices are
+ * only ever written by their owner, the semaphore is used just to let the
+ * consumer sleep while the ring is empty. */
+typedef struct
+{
+    pcm_ring_item_t items[PCM_RING_SLOTS];
+    atomic_t head; // Written by producer only
+    atomic_t tail; // Written by consumer only
+    struct k_sem available;
+} pcm_ring_t;
+
+void pcm_ring_init(pcm_ring_t *ring);
+
+/* Producer side */
+int pcm_ring_push(pcm_ring_t *ring, void *block, size_t frames, int32_t track_start);
+
+/* Consumer side */
+int pcm_ring_pop(pcm_ring_t *ring, pcm_ring_item_t *item, k_timeout_t timeout);
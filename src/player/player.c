@@ -1,4 +1,5 @@
 #include "player.h"
+#include "pcm_ring.h"
 #include <decoder.h>
 #include <utils.h>
 #include <zephyr/kernel.h>
@@ -6,31 +7,53 @@
 #include <zephyr/drivers/i2s.h>
 #include <math.h>
 
-#define PLAYER_I2S_BLOCK_SIZE_FRAMES (1024 * 4)
-#define PLAYER_I2S_BUFFER_BLOCKS 2
+#define PLAYER_BLOCK_DURATION_MS 20 // Used until block latency has been measured
+#define PLAYER_BLOCK_DURATION_MIN_MS 10 // Block size is then chosen per track from this range
+#define PLAYER_BLOCK_DURATION_MAX_MS 30
+#define PLAYER_BLOCK_DURATION_STEP_MS 5
+#define PLAYER_BLOCK_FRAMES_ALIGN 32
+#define PLAYER_BUFFER_BUDGET (1024 * 48) // RAM shared by all blocks, regardless of their size
+#define PLAYER_I2S_QUEUE_DEPTH 4 // Should match CONFIG_I2S_NRFX_TX_BLOCK_COUNT
+#define PLAYER_STREAM_PRIME_BLOCKS 2 // Blocks queued before I2S is started
+
+/* Adaptive depth - number of blocks decoded ahead, including those queued in I2S driver */
+#define PLAYER_DEPTH_MIN (PLAYER_I2S_QUEUE_DEPTH + 2)
+#define PLAYER_DEPTH_HEADROOM 2 // Worst block latency seen is covered this many times
+#define PLAYER_DEPTH_SHRINK_BLOCKS 256 // Blocks without need for current depth before shrinking it
+#define PLAYER_DEPTH_UNDERRUN_STEP 2
+#define PLAYER_LATENCY_PEAK_DECAY_SHIFT 6 // Peak latency decays by 1/64 per block
+#define PLAYER_LATENCY_AVG_SHIFT 4 // Exponential moving average with 1/16 weight
 
 #define PLAYER_SAMPLE_BIT_WIDTH 16
 #define PLAYER_BYTES_PER_SAMPLE sizeof(int16_t)
 #define PLAYER_CHANNELS_NUM 2
+#define PLAYER_BYTES_PER_FRAME (PLAYER_CHANNELS_NUM * PLAYER_BYTES_PER_SAMPLE)
 
 #define PLAYER_VOLUME_MIN 0
 #define PLAYER_VOLUME_MAX 100 // %
 
-#define PLAYER_I2S_BLOCK_SIZE_SAMPLES (PLAYER_CHANNELS_NUM * PLAYER_I2S_BLOCK_SIZE_FRAMES)
-#define PLAYER_I2S_BLOCK_SIZE (PLAYER_BYTES_PER_SAMPLE * PLAYER_I2S_BLOCK_SIZE_SAMPLES)
-#define PLAYER_I2S_BUFFER_SIZE (PLAYER_I2S_BUFFER_BLOCKS * PLAYER_I2S_BLOCK_SIZE)
-
 #define PLAYER_PATH_MAX (255 + 1)
 
-#define PLAYER_THREAD_STACK_SIZE (1024 * 6)
-#define PLAYER_THREAD_PRIORITY 9
+#define PLAYER_THREAD_STACK_SIZE (1024 * 4)
+#define PLAYER_THREAD_PRIORITY 7 // Has to preempt prefetch and decoder threads to keep I2S fed
+
+#define PLAYER_DECODER_THREAD_STACK_SIZE (1024 * 6)
+#define PLAYER_DECODER_THREAD_PRIORITY 9
+#define PLAYER_DECODER_ALLOC_TIMEOUT_MS 50 // Interval of checking abort request while buffer is full
+#define PLAYER_DECODER_THROTTLE_MS 5 // Interval of checking whether depth allows to decode another block
+
+#define PLAYER_FEEDER_POLL_MS 20 // Max time of waiting for data before checking requests
+
+#define PLAYER_DRAIN_POLL_MS 5
+#define PLAYER_DRAIN_TIMEOUT_MS 1000
 
 typedef enum
 {
     PLAYER_START,
     PLAYER_PAUSE,
     PLAYER_RESUME,
-    PLAYER_STOP
+    PLAYER_STOP,
+    PLAYER_SEEK
 } player_request_t;
 
 #define PLAYER_REQUEST_QUEUE_LENGTH 2
@@ -41,19 +64,72 @@ typedef struct
 {
     int16_t volume;
     struct k_mem_slab i2s_mem_slab;
-    char __attribute__((aligned(4))) i2c_mem_slab_buf[PLAYER_I2S_BUFFER_SIZE];
+    char __attribute__((aligned(4))) i2c_mem_slab_buf[PLAYER_BUFFER_BUDGET];
     const struct device *i2s_tx;
-    const struct decoder_interface_t *decoder;
+    struct decoder_t decoder;
     player_state_t state;
     struct k_msgq request_queue;
     char __attribute__((aligned(4))) request_queue_buf[PLAYER_REQUEST_QUEUE_SIZE];
     char file_path[PLAYER_PATH_MAX];
     struct k_thread player_thread;
+
+    /* Decoder thread and its output */
+    pcm_ring_t pcm_ring;
+    struct k_thread decoder_thread;
+    struct k_sem decoder_start;
+    struct k_sem decoder_idle;
+    atomic_t decoder_abort;
+    bool decoder_running; // Accessed only by player thread
+    bool end_of_stream; // Accessed only by player thread
+    bool decoder_ahead; // Decoder has switched to the next track which is not being played yet
+    bool decoder_seek; // Decoder seeks before it starts decoding, on its own stack, as seeking decodes too
+    size_t decoder_seek_frame; // Target, replaced with position reached once seek is done
+    int decoder_seek_result;
+    struct k_sem decoder_seek_done;
+    atomic_t bitrate; // Of the last block decoded, decoder itself may be swapped or closed meanwhile
+    size_t frames_played;
+
+    /* Parameters of the track being played, decoder may already be on the next one */
+    size_t frames_total;
+    size_t next_frames_total;
+    uint32_t sample_rate;
+    uint32_t track_seq; // Incremented whenever player moves on to the next track by itself
+
+    /* Next track hint for gapless playback */
+    struct k_mutex next_lock;
+    char next_path[PLAYER_PATH_MAX];
+    struct decoder_t next_decoder; // Owned by decoder thread, opened in advance
+    char next_decoder_path[PLAYER_PATH_MAX];
+
+    /* Buffer geometry and latency statistics, updated by decoder thread */
+    size_t block_frames;
+    size_t block_size;
+    size_t blocks_max;
+    size_t depth; // Written only by decoder thread, or while it's stopped
+    size_t depth_needed_blocks; // Blocks since depth was last fully needed
+    atomic_t depth_underrun_steps; // Posted by player thread on underrun, applied by decoder thread
+    uint32_t decode_time_avg_us;
+    uint32_t decode_time_max_us;
+    uint32_t block_time_peak_us; // Decaying peak of decode and read time per block, drives depth and block size, kept between tracks
+    uint32_t read_time_avg_us;
+    uint32_t read_time_max_us;
+    uint32_t underruns;
+
+    /* Storage access statistics of playback session */
+    decoder_stream_stats_t io_stats_start;
+    decoder_prefetch_stats_t prefetch_stats_start;
+    size_t frames_decoded;
+
+    /* Seeking, target is updated in place while request is pending, so that repeated seeks do not pile up */
+    atomic_t seek_pending;
+    size_t seek_frame;
+    uint32_t seek_latency_ms;
 } player_ctx_t;
 
 static player_ctx_t ctx;
 
 K_THREAD_STACK_DEFINE(player_stack, PLAYER_THREAD_STACK_SIZE);
+K_THREAD_STACK_DEFINE(decoder_stack, PLAYER_DECODER_THREAD_STACK_SIZE);
 
 LOG_MODULE_REGISTER(player);
    
@@ -64,54 +140,497 @@ static void volume_scale(int16_t *samples, size_t samples_count, int16_t volume)
     }
 }
 
-static int decode_and_push_stream(void)
+static uint32_t block_duration_us(size_t frames)
+{
+    if (ctx.sample_rate == 0) {
+        return 0;
+    }
+    return ((uint64_t)frames * USEC_PER_SEC) / ctx.sample_rate;
+}
+
+static void update_depth(uint32_t decode_time_us, uint32_t read_time_us)
 {
+    /* Track latency statistics */
+    const uint32_t block_time_us = decode_time_us + read_time_us;
+
+    /* Buffering was not enough, decode further ahead from now on */
+    const atomic_val_t underrun_steps = atomic_clear(&ctx.depth_underrun_steps);
+    if (underrun_steps > 0) {
+        ctx.depth = MIN(ctx.depth + (underrun_steps * PLAYER_DEPTH_UNDERRUN_STEP), ctx.blocks_max);
+        ctx.depth_needed_blocks = 0;
+    }
+
+    ctx.decode_time_avg_us += ((int32_t)decode_time_us - (int32_t)ctx.decode_time_avg_us) >> PLAYER_LATENCY_AVG_SHIFT;
+    ctx.read_time_avg_us += ((int32_t)read_time_us - (int32_t)ctx.read_time_avg_us) >> PLAYER_LATENCY_AVG_SHIFT;
+    ctx.decode_time_max_us = MAX(ctx.decode_time_max_us, decode_time_us);
+    ctx.read_time_max_us = MAX(ctx.read_time_max_us, read_time_us);
+
+    ctx.block_time_peak_us -= ctx.block_time_peak_us >> PLAYER_LATENCY_PEAK_DECAY_SHIFT;
+    ctx.block_time_peak_us = MAX(ctx.block_time_peak_us, block_time_us);
+
+    /* Buffered audio has to cover the worst recent stall with some headroom */
+    const uint32_t block_us = block_duration_us(ctx.block_frames);
+    if (block_us == 0) {
+        return;
+    }
+
+    size_t depth = DIV_ROUND_UP(ctx.block_time_peak_us * PLAYER_DEPTH_HEADROOM, block_us) + PLAYER_DEPTH_MIN;
+    depth = CLAMP(depth, PLAYER_DEPTH_MIN, ctx.blocks_max);
+
+    /* Grow immediately, shrink only when current depth has not been needed for a while */
+    if (depth >= ctx.depth) {
+        ctx.depth = depth;
+        ctx.depth_needed_blocks = 0;
+    }
+    else if (++ctx.depth_needed_blocks >= PLAYER_DEPTH_SHRINK_BLOCKS) {
+        --ctx.depth;
+        ctx.depth_needed_blocks = 0;
+    }
+}
+
+static bool take_next_path(char *path, size_t size)
+{
+    k_mutex_lock(&ctx.next_lock, K_FOREVER);
+    const bool available = (ctx.next_path[0] != '\0');
+    if (available) {
+        utils_strlcpy(path, ctx.next_path, size);
+        ctx.next_path[0] = '\0';
+    }
+    k_mutex_unlock(&ctx.next_lock);
+
+    return available;
+}
+
+static bool peek_next_path(char *path, size_t size)
+{
+    k_mutex_lock(&ctx.next_lock, K_FOREVER);
+    const bool available = (ctx.next_path[0] != '\0');
+    if (available) {
+        utils_strlcpy(path, ctx.next_path, size);
+    }
+    k_mutex_unlock(&ctx.next_lock);
+
+    return available;
+}
+
+/* Called from decoder thread while it waits for space in the buffer. Opens
+ * and primes decoder of hinted next track, so that switching to it at the
+ * end of current one costs nothing. */
+static void prepare_next_track(void)
+{
+    char path[PLAYER_PATH_MAX];
+
+    if (!peek_next_path(path, sizeof(path))) {
+        return;
+    }
+
+    /* Already prepared, or failed to, for this hint */
+    if (strcmp(path, ctx.next_decoder_path) == 0) {
+        return;
+    }
+
+    /* Hint has changed */
+    decoder_close(&ctx.next_decoder);
+    utils_strlcpy(ctx.next_decoder_path, path, sizeof(ctx.next_decoder_path));
+
+    const int err = decoder_open_pooled(&ctx.next_decoder, path);
+    if (err) {
+        LOG_ERR("Failed to open next track decoder, error %d!", err);
+    }
+}
+
+/* Called from decoder thread when current track has been fully decoded. If next track
+ * can continue the same I2S stream, replaces current decoder with the one of next track. */
+static bool open_next_track(void)
+{
+    char path[PLAYER_PATH_MAX];
+
+    prepare_next_track();
+    if (!decoder_is_open(&ctx.next_decoder)) {
+        return false;
+    }
+
+    /* Different sample rate requires I2S reconfiguration, let player start it regularly */
+    const uint32_t sample_rate = ctx.next_decoder.interface->get_sample_rate(ctx.next_decoder.state);
+    if (sample_rate != ctx.sample_rate) {
+        decoder_close(&ctx.next_decoder);
+        return false;
+    }
+
+    /* Hint might have been cleared or changed in the meantime */
+    if (!take_next_path(path, sizeof(path)) || (strcmp(path, ctx.next_decoder_path) != 0)) {
+        decoder_close(&ctx.next_decoder);
+        return false;
+    }
+
+    decoder_close(&ctx.decoder);
+    ctx.decoder = ctx.next_decoder;
+    ctx.next_decoder = (struct decoder_t){0};
+    ctx.next_frames_total = ctx.decoder.interface->get_pcm_frames_total(ctx.decoder.state);
+    ctx.decoder_ahead = true;
+    decoder_prefetch(&ctx.decoder);
+
+    LOG_INF("Continuing gapless with '%s'", path);
+
+    return true;
+}
+
+static void decoder_task(void *p1, void *p2, void *p3)
+{
+    ARG_UNUSED(p1);
+    ARG_UNUSED(p2);
+    ARG_UNUSED(p3);
+
     void *block;
 
-    int err = k_mem_slab_alloc(&ctx.i2s_mem_slab, &block, K_FOREVER);
+    while (1) {
+        /* Wait until player has a decoder ready */
+        k_sem_take(&ctx.decoder_start, K_FOREVER);
+
+        int seek_err = 0;
+        if (ctx.decoder_seek) {
+            ctx.decoder_seek = false;
+            seek_err = ctx.decoder.interface->seek(ctx.decoder.state, ctx.decoder_seek_frame);
+            ctx.decoder_seek_result = seek_err;
+            ctx.decoder_seek_frame = ctx.decoder.interface->get_pcm_frames_played(ctx.decoder.state);
+            k_sem_give(&ctx.decoder_seek_done);
+        }
+
+        while (!seek_err && !atomic_get(&ctx.decoder_abort)) {
+            /* Do not decode further ahead than current depth allows */
+            if (k_mem_slab_num_used_get(&ctx.i2s_mem_slab) >= ctx.depth) {
+                /* Make use of idle time */
+                if (ctx.decoder.interface->idle != NULL) {
+                    ctx.decoder.interface->idle(ctx.decoder.state);
+                }
+                prepare_next_track();
+                k_msleep(PLAYER_DECODER_THROTTLE_MS);
+                continue;
+            }
+
+            /* Blocks until there is free space in the buffer */
+            int err = k_mem_slab_alloc(&ctx.i2s_mem_slab, &block, K_MSEC(PLAYER_DECODER_ALLOC_TIMEOUT_MS));
+            if (err) {
+                continue;
+            }
+
+            decoder_stream_stats_t io_stats_start, io_stats;
+            decoder_stream_get_stats(&io_stats_start);
+            const uint32_t cycles_start = k_cycle_get_32();
+
+            size_t frames_read = ctx.decoder.interface->read_pcm_frames(ctx.decoder.state, block, ctx.block_frames);
+
+            decoder_stream_get_stats(&io_stats);
+            const uint32_t io_cycles = io_stats.io_cycles - io_stats_start.io_cycles;
+            const uint32_t cycles = k_cycle_get_32() - cycles_start;
+
+            /* End of track - fill rest of the block from the next one, if it's been hinted */
+            int32_t track_start = PCM_RING_NO_TRACK_START;
+            if ((frames_read < ctx.block_frames) && open_next_track()) {
+                int16_t *samples = block;
+                track_start = frames_read;
+                frames_read += ctx.decoder.interface->read_pcm_frames(ctx.decoder.state, &samples[frames_read * PLAYER_CHANNELS_NUM], ctx.block_frames - frames_read);
+            }
+
+            if (frames_read == 0) {
+                k_mem_slab_free(&ctx.i2s_mem_slab, block);
+                break;
+            }
+
+            update_depth(k_cyc_to_us_floor32(cycles - io_cycles), k_cyc_to_us_floor32(io_cycles));
+
+            /* Pad last, incomplete block with silence */
+            if (frames_read < ctx.block_frames) {
+                uint8_t *bytes = block;
+                const size_t bytes_read = frames_read * PLAYER_BYTES_PER_FRAME;
+                memset(&bytes[bytes_read], 0, ctx.block_size - bytes_read);
+            }
+
+            err = pcm_ring_push(&ctx.pcm_ring, block, frames_read, track_start);
+            if (err) {
+                k_mem_slab_free(&ctx.i2s_mem_slab, block);
+                break;
+            }
+            ctx.frames_decoded += frames_read;
+            atomic_set(&ctx.bitrate, ctx.decoder.interface->get_current_bitrate(ctx.decoder.state));
+
+            /* Incomplete block means there is nothing more to decode */
+            if (frames_read < ctx.block_frames) {
+                break;
+            }
+        }
+
+        /* Mark end of stream and report that decoder is no longer used */
+        pcm_ring_push(&ctx.pcm_ring, NULL, 0, PCM_RING_NO_TRACK_START);
+        k_sem_give(&ctx.decoder_idle);
+    }
+}
+
+/* Pending seek target is relative to the track it was requested in, request still queued is dropped when handled */
+static void discard_seek(void)
+{
+    atomic_set(&ctx.seek_pending, 0);
+}
+
+static void start_decoding(void)
+{
+    atomic_set(&ctx.decoder_abort, 0);
+    ctx.decoder_running = true;
+    ctx.end_of_stream = false;
+    k_sem_give(&ctx.decoder_start);
+}
+
+static void flush_ring(void)
+{
+    pcm_ring_item_t item;
+
+    while (pcm_ring_pop(&ctx.pcm_ring, &item, K_NO_WAIT) == 0) {
+        if (item.block != NULL) {
+            k_mem_slab_free(&ctx.i2s_mem_slab, item.block);
+        }
+    }
+}
+
+static void stop_decoding(void)
+{
+    if (!ctx.decoder_running) {
+        return;
+    }
+
+    atomic_set(&ctx.decoder_abort, 1);
+    k_sem_take(&ctx.decoder_idle, K_FOREVER);
+    ctx.decoder_running = false;
+
+    flush_ring();
+}
+
+static int feed_stream(k_timeout_t timeout)
+{
+    pcm_ring_item_t item;
+
+    if (ctx.end_of_stream) {
+        return -ENODATA;
+    }
+
+    int err = pcm_ring_pop(&ctx.pcm_ring, &item, timeout);
     if (err) {
-        return err;
+        return -EAGAIN;
     }
 
-    const size_t bytes_read = ctx.decoder->read_pcm_frames(block, PLAYER_I2S_BLOCK_SIZE_FRAMES);
-    if (bytes_read <= 0) {
-        k_mem_slab_free(&ctx.i2s_mem_slab, block);
+    if (item.block == NULL) {
+        ctx.end_of_stream = true;
         return -ENODATA;
     }
 
-    volume_scale(block, PLAYER_I2S_BLOCK_SIZE_SAMPLES, ctx.volume);
+    /* Track boundary within block, from now on next track is being played. Done even
+     * if the block fails to be written, decoder has moved on to the next track anyway. */
+    if (item.track_start != PCM_RING_NO_TRACK_START) {
+        ctx.frames_played = item.frames - item.track_start;
+        ctx.frames_total = ctx.next_frames_total;
+        ctx.decoder_ahead = false;
+        ++ctx.track_seq;
+        discard_seek();
+    }
+    else {
+        ctx.frames_played += item.frames;
+    }
 
-    err = i2s_write(ctx.i2s_tx, block, PLAYER_I2S_BLOCK_SIZE);
+    volume_scale(item.block, item.frames * PLAYER_CHANNELS_NUM, ctx.volume);
+
+    err = i2s_write(ctx.i2s_tx, item.block, ctx.block_size);
     if (err) {
-        k_mem_slab_free(&ctx.i2s_mem_slab, block);
+        k_mem_slab_free(&ctx.i2s_mem_slab, item.block);
+        if (err == -EIO) {
+            /* Depth is grown by decoder thread, which updates it with every block */
+            ++ctx.underruns;
+            atomic_inc(&ctx.depth_underrun_steps);
+        }
         return err;
     }
+
     return 0;
 }
 
 static int initialize_stream(void)
 {
     i2s_trigger(ctx.i2s_tx, I2S_DIR_TX, I2S_TRIGGER_DROP);
-    for (size_t i = 0; i < PLAYER_I2S_BUFFER_BLOCKS; ++i) {
-        decode_and_push_stream();
+    for (size_t i = 0; i < PLAYER_STREAM_PRIME_BLOCKS; ++i) {
+        if (feed_stream(K_FOREVER) != 0) {
+            break; // Start with whatever has been queued
+        }
     }
     return i2s_trigger(ctx.i2s_tx, I2S_DIR_TX, I2S_TRIGGER_START);
 }
 
-static void player_task(void *p1, void *p2, void *p3)
+static void drain_stream(void)
 {
-    ARG_UNUSED(p1);
-    ARG_UNUSED(p2);
-    ARG_UNUSED(p3);
+    i2s_trigger(ctx.i2s_tx, I2S_DIR_TX, I2S_TRIGGER_DRAIN);
 
-    k_msgq_init(&ctx.request_queue, ctx.request_queue_buf, PLAYER_REQUEST_SIZE, PLAYER_REQUEST_QUEUE_LENGTH);
+    /* Driver returns blocks to the slab once they have been played */
+    for (size_t i = 0; i < (PLAYER_DRAIN_TIMEOUT_MS / PLAYER_DRAIN_POLL_MS); ++i) {
+        if (k_mem_slab_num_used_get(&ctx.i2s_mem_slab) == 0) {
+            break;
+        }
+        k_msleep(PLAYER_DRAIN_POLL_MS);
+    }
 
-    int err = k_mem_slab_init(&ctx.i2s_mem_slab, ctx.i2c_mem_slab_buf, PLAYER_I2S_BLOCK_SIZE, PLAYER_I2S_BUFFER_BLOCKS);
+    i2s_trigger(ctx.i2s_tx, I2S_DIR_TX, I2S_TRIGGER_DROP);
+}
+
+static int seek_stream(size_t pcm_frame)
+{
+    const int64_t start_time = k_uptime_get();
+
+    /* Decoder has already moved on to the next track, while target is a position in the current one.
+     * Only the last buffered blocks of the track are left then, so the seek is ignored. */
+    if (ctx.decoder_ahead) {
+        LOG_INF("Track is about to end, seek ignored");
+        return 0;
+    }
+
+    /* Discard whatever has been decoded ahead, decoder has to be idle to be moved */
+    i2s_trigger(ctx.i2s_tx, I2S_DIR_TX, I2S_TRIGGER_DROP);
+    stop_decoding();
+
+    if ((ctx.frames_total > 0) && (pcm_frame >= ctx.frames_total)) {
+        pcm_frame = ctx.frames_total - 1;
+    }
+
+    /* Decoder thread seeks and goes on decoding from there */
+    ctx.decoder_seek = true;
+    ctx.decoder_seek_frame = pcm_frame;
+    start_decoding();
+    k_sem_take(&ctx.decoder_seek_done, K_FOREVER);
+
+    int err = ctx.decoder_seek_result;
     if (err) {
-        LOG_ERR("Failed to initialize I2S memory slab, error %d!", err);
+        LOG_ERR("Failed to seek to frame %u, error %d!", pcm_frame, err);
+        return err;
+    }
+    ctx.frames_played = ctx.decoder_seek_frame;
+
+    /* Paused stream gets restarted on resume */
+    if (ctx.state == PLAYER_PLAYING) {
+        err = initialize_stream();
+        if (err) {
+            return err;
+        }
+    }
+
+    ctx.seek_latency_ms = k_uptime_get() - start_time;
+    LOG_INF("Seek to frame %u took %u ms", ctx.frames_played, ctx.seek_latency_ms);
+
+    return 0;
+}
+
+static void report_io_stats(void)
+{
+    decoder_stream_stats_t io_stats;
+
+    const uint32_t seconds_decoded = (ctx.sample_rate != 0) ? (ctx.frames_decoded / ctx.sample_rate) : 0;
+    if (seconds_decoded == 0) {
         return;
     }
 
+    decoder_stream_get_stats(&io_stats);
+    const uint32_t fs_reads = io_stats.fs_reads - ctx.io_stats_start.fs_reads;
+    const uint32_t requests = io_stats.requests - ctx.io_stats_start.requests;
+
+    LOG_INF("%u fs_read calls per second of audio, for %u decoder reads", fs_reads / seconds_decoded, requests / seconds_decoded);
+
+    decoder_prefetch_stats_t prefetch_stats;
+    decoder_prefetch_get_stats(&prefetch_stats);
+    LOG_INF("Prefetch: %u stalls avoided, %u stalls, %u window resets",
+            prefetch_stats.hits - ctx.prefetch_stats_start.hits,
+            prefetch_stats.stalls - ctx.prefetch_stats_start.stalls,
+            prefetch_stats.resets - ctx.prefetch_stats_start.resets);
+}
+
+static size_t get_block_frames(uint32_t sample_rate, uint32_t duration_ms)
+{
+    const size_t block_frames = (sample_rate * duration_ms) / MSEC_PER_SEC;
+    return ROUND_UP(MAX(block_frames, PLAYER_BLOCK_FRAMES_ALIGN), PLAYER_BLOCK_FRAMES_ALIGN);
+}
+
+/* As many blocks as fit in the budget, small blocks are limited by ring slots instead */
+static size_t get_blocks_max(size_t block_frames)
+{
+    return MIN(PLAYER_BUFFER_BUDGET / (block_frames * PLAYER_BYTES_PER_FRAME), PCM_RING_SLOTS - 1); // Leave slot for end marker
+}
+
+/* Smaller blocks make starting and seeking faster, but less audio fits in ring slots. Picks the smallest
+ * block whose depth range covers the worst block latency seen so far, or the one with the widest range if none does. */
+static size_t choose_block_frames(uint32_t sample_rate)
+{
+    size_t best_block_frames = get_block_frames(sample_rate, PLAYER_BLOCK_DURATION_MS);
+    uint64_t best_range_us = 0;
+
+    if ((sample_rate == 0) || (ctx.block_time_peak_us == 0)) {
+        return best_block_frames;
+    }
+
+    const uint64_t range_needed_us = (uint64_t)ctx.block_time_peak_us * PLAYER_DEPTH_HEADROOM;
+
+    for (uint32_t duration_ms = PLAYER_BLOCK_DURATION_MIN_MS; duration_ms <= PLAYER_BLOCK_DURATION_MAX_MS; duration_ms += PLAYER_BLOCK_DURATION_STEP_MS) {
+        const size_t block_frames = get_block_frames(sample_rate, duration_ms);
+        const size_t blocks_max = get_blocks_max(block_frames);
+        if (blocks_max < PLAYER_DEPTH_MIN) {
+            break; // Larger blocks fit even fewer
+        }
+
+        const uint64_t block_us = ((uint64_t)block_frames * USEC_PER_SEC) / sample_rate;
+        const uint64_t range_us = (blocks_max - PLAYER_DEPTH_MIN) * block_us;
+        if (range_us >= range_needed_us) {
+            return block_frames;
+        }
+        if (range_us > best_range_us) {
+            best_range_us = range_us;
+            best_block_frames = block_frames;
+        }
+    }
+
+    return best_block_frames;
+}
+
+static int configure_buffer(uint32_t sample_rate)
+{
+    const size_t block_frames = choose_block_frames(sample_rate);
+    const size_t block_size = block_frames * PLAYER_BYTES_PER_FRAME;
+    const size_t blocks_max = get_blocks_max(block_frames);
+    if (blocks_max < PLAYER_DEPTH_MIN) {
+        return -ENOMEM;
+    }
+
+    /* No blocks are in use at this point, slab can be safely reinitialized */
+    const int err = k_mem_slab_init(&ctx.i2s_mem_slab, ctx.i2c_mem_slab_buf, block_size, blocks_max);
+    if (err) {
+        return err;
+    }
+
+    ctx.block_frames = block_frames;
+    ctx.block_size = block_size;
+    ctx.blocks_max = blocks_max;
+    ctx.depth = (PLAYER_DEPTH_MIN + blocks_max) / 2;
+    ctx.depth_needed_blocks = 0;
+    atomic_clear(&ctx.depth_underrun_steps);
+    ctx.decode_time_avg_us = 0;
+    ctx.decode_time_max_us = 0;
+    ctx.read_time_avg_us = 0;
+    ctx.read_time_max_us = 0;
+
+    LOG_INF("Using %u blocks of %u frames, initial depth %u, worst block latency %u us", blocks_max, block_frames, ctx.depth, ctx.block_time_peak_us);
+
+    return 0;
+}
+
+static void player_task(void *p1, void *p2, void *p3)
+{
+    ARG_UNUSED(p1);
+    ARG_UNUSED(p2);
+    ARG_UNUSED(p3);
+
+    int err;
+
     ctx.i2s_tx = DEVICE_DT_GET(DT_ALIAS(audio_i2s));
     ctx.state = PLAYER_STOPPED;
 
@@ -121,46 +640,67 @@ static void player_task(void *p1, void *p2, void *p3)
         .format = I2S_FMT_DATA_FORMAT_I2S,
         .options = I2S_OPT_BIT_CLK_CONTROLLER | I2S_OPT_FRAME_CLK_CONTROLLER,
         .mem_slab = &ctx.i2s_mem_slab,
-        .block_size = PLAYER_I2S_BLOCK_SIZE,
         .timeout = 1000
     };
 
     player_request_t request;
+    bool play_next = false;
     
     while (1) {
-        /* Wait for start message */
-        k_msgq_get(&ctx.request_queue, &request, K_FOREVER);
-        if (request != PLAYER_START) {
-            LOG_WRN("Invalid request %d!", request);
-            continue;
+        /* Wait for start message, unless next track could not be continued gaplessly */
+        if (play_next && take_next_path(ctx.file_path, sizeof(ctx.file_path))) {
+            ++ctx.track_seq;
+        }
+        else {
+            k_msgq_get(&ctx.request_queue, &request, K_FOREVER);
+            if (request != PLAYER_START) {
+                if (request != PLAYER_SEEK) {
+                    LOG_WRN("Invalid request %d!", request);
+                }
+                discard_seek();
+                continue;
+            }
         }
+        play_next = false;
 
         LOG_INF("Starting playback of '%s'", ctx.file_path);
-
-        /* Get decoder for file */
-        ctx.decoder = decoder_get_interface(ctx.file_path);
-        if (ctx.decoder == NULL) {
-            LOG_ERR("Could not find decoder for requested file!");
-            continue;
-        }
+        decoder_stream_get_stats(&ctx.io_stats_start);
+        decoder_prefetch_get_stats(&ctx.prefetch_stats_start);
+        ctx.frames_decoded = 0;
 
         do {
-            /* Initialize decoder */
-            err = ctx.decoder->init(ctx.file_path);
+            /* Get decoder for file and initialize it */
+            err = decoder_open_pooled(&ctx.decoder, ctx.file_path);
+            if (err) {
+                LOG_ERR("Failed to open decoder, error %d!", err);
+                break;
+            }
+            ctx.sample_rate = ctx.decoder.interface->get_sample_rate(ctx.decoder.state);
+            ctx.frames_total = ctx.decoder.interface->get_pcm_frames_total(ctx.decoder.state);
+            decoder_prefetch(&ctx.decoder);
+
+            /* Size buffer for stream sample rate */
+            i2s_cfg.frame_clk_freq = ctx.sample_rate;
+            err = configure_buffer(i2s_cfg.frame_clk_freq);
             if (err) {
-                LOG_ERR("Failed to initialize decoder, error %d!", err);
+                LOG_ERR("Failed to configure buffer, error %d!", err);
                 break;
             }
 
             /* Set sample rate and configure I2S */
-            i2s_cfg.frame_clk_freq = ctx.decoder->get_sample_rate();
+            i2s_cfg.block_size = ctx.block_size;
             err = i2s_configure(ctx.i2s_tx, I2S_DIR_TX, &i2s_cfg);
             if (err < 0) {
                 LOG_ERR("Failed to configure I2S Tx stream, error %d!", err);
                 break;
             }
 
-            /* Start I2S */
+            /* Start decoding and I2S */
+            ctx.frames_played = 0;
+            ctx.decoder_ahead = false;
+            ctx.next_decoder_path[0] = '\0';
+            start_decoding();
+
             err = initialize_stream();
             if (err < 0) {
                 LOG_ERR("Failed to initialize stream, error %d!", err);
@@ -185,11 +725,27 @@ static void player_task(void *p1, void *p2, void *p3)
                         i2s_trigger(ctx.i2s_tx, I2S_DIR_TX, I2S_TRIGGER_DROP);
                         break;
                     }
+                    else if ((request == PLAYER_SEEK) && atomic_cas(&ctx.seek_pending, 1, 0)) {
+                        /* Target read after clearing pending flag, later seek queues another request */
+                        err = seek_stream(ctx.seek_frame);
+                        if (err) {
+                            break;
+                        }
+                    }
                 }
 
-                /* Decode and push stream if playback in progress */
+                /* Push decoded stream if playback in progress */
                 if (ctx.state == PLAYER_PLAYING) {
-                    err = decode_and_push_stream();
+                    err = feed_stream(K_MSEC(PLAYER_FEEDER_POLL_MS));
+                    if (err == -EAGAIN) {
+                        continue; // Decoder not ready yet, check for requests
+                    }
+                    if (err == -ENODATA) {
+                        /* Let the last blocks play out and move on to hinted track, if any */
+                        drain_stream();
+                        play_next = true;
+                        break;
+                    }
                     if (err == -EIO) {
                         LOG_WRN("Buffer underrun! Restarting stream...");
                         err = initialize_stream();
@@ -208,13 +764,43 @@ static void player_task(void *p1, void *p2, void *p3)
             }
         } while (0);
 
-        ctx.state = PLAYER_STOPPED;
-        ctx.decoder->deinit();
+        stop_decoding();
+        decoder_close(&ctx.decoder);
+        decoder_close(&ctx.next_decoder);
+        atomic_set(&ctx.bitrate, 0);
+        discard_seek();
+        report_io_stats();
+
+        /* Do not report stop if going to continue with next track right away */
+        if (!play_next || !peek_next_path(ctx.file_path, sizeof(ctx.file_path))) {
+            play_next = false;
+            ctx.state = PLAYER_STOPPED;
+        }
     }
 }
 
 void player_init(void)
 {
+    k_msgq_init(&ctx.request_queue, ctx.request_queue_buf, PLAYER_REQUEST_SIZE, PLAYER_REQUEST_QUEUE_LENGTH);
+    k_sem_init(&ctx.decoder_start, 0, 1);
+    k_sem_init(&ctx.decoder_idle, 0, 1);
+    k_sem_init(&ctx.decoder_seek_done, 0, 1);
+    k_mutex_init(&ctx.next_lock);
+    pcm_ring_init(&ctx.pcm_ring);
+    decoder_prefetch_init();
+
+    k_thread_create(&ctx.decoder_thread,
+                    decoder_stack,
+                    K_THREAD_STACK_SIZEOF(decoder_stack),
+                    decoder_task,
+                    NULL,
+                    NULL,
+                    NULL,
+                    PLAYER_DECODER_THREAD_PRIORITY,
+                    0,
+                    K_NO_WAIT);
+    k_thread_name_set(&ctx.decoder_thread, "decoder");
+
     k_thread_create(&ctx.player_thread,
                     player_stack,
                     K_THREAD_STACK_SIZEOF(player_stack),
@@ -225,6 +811,7 @@ void player_init(void)
                     PLAYER_THREAD_PRIORITY,
                     0,
                     K_NO_WAIT);
+    k_thread_name_set(&ctx.player_thread, "player");
 }
 
 void player_start(const char *path)
@@ -237,11 +824,26 @@ void player_start(const char *path)
         player_stop();
     }
 
+    /* Hint given for previous track is no longer valid */
+    player_set_next(NULL);
+
     const player_request_t request = PLAYER_START;
     utils_strlcpy(ctx.file_path, path, sizeof(ctx.file_path));
     k_msgq_put(&ctx.request_queue, &request, K_FOREVER);
 }
 
+void player_set_next(const char *path)
+{
+    k_mutex_lock(&ctx.next_lock, K_FOREVER);
+    if (path == NULL) {
+        ctx.next_path[0] = '\0';
+    }
+    else {
+        utils_strlcpy(ctx.next_path, path, sizeof(ctx.next_path));
+    }
+    k_mutex_unlock(&ctx.next_lock);
+}
+
 void player_pause(void)
 {
     const player_request_t request = PLAYER_PAUSE;
@@ -260,6 +862,34 @@ void player_stop(void)
     k_msgq_put(&ctx.request_queue, &request, K_FOREVER);
 }
 
+void player_seek(size_t pcm_frame)
+{
+    if (ctx.state == PLAYER_STOPPED) {
+        return;
+    }
+
+    ctx.seek_frame = pcm_frame;
+
+    /* Request already queued will pick up the new target */
+    if (atomic_cas(&ctx.seek_pending, 0, 1)) {
+        const player_request_t request = PLAYER_SEEK;
+        k_msgq_put(&ctx.request_queue, &request, K_FOREVER);
+    }
+}
+
+void player_seek_relative(int32_t pcm_frames)
+{
+    /* Relative to pending target, if there is one, so that consecutive seeks add up */
+    const size_t origin = atomic_get(&ctx.seek_pending) ? ctx.seek_frame : ctx.frames_played;
+
+    if ((pcm_frames < 0) && ((size_t)(-pcm_frames) > origin)) {
+        player_seek(0);
+    }
+    else {
+        player_seek(origin + pcm_frames);
+    }
+}
+
 void player_set_volume(uint8_t volume)
 {
     if (volume == 0) {
@@ -282,32 +912,54 @@ player_state_t player_get_state(void)
 
 size_t player_get_pcm_frames_played(void)
 {
-    if (ctx.decoder != NULL) {
-        return ctx.decoder->get_pcm_frames_played();
-    }
-    return 0;
+    /* Decoder runs ahead of the output, count what has been actually sent to I2S */
+    return ctx.frames_played;
 }
 
 size_t player_get_pcm_frames_total(void)
 {
-    if (ctx.decoder != NULL) {
-        return ctx.decoder->get_pcm_frames_total();
-    }
-    return 0;
+    return ctx.frames_total;
 }
 
 uint32_t player_get_pcm_sample_rate(void)
 {
-    if (ctx.decoder != NULL) {
-        return ctx.decoder->get_sample_rate();
-    }
-    return 0;
+    return ctx.sample_rate;
 }
 
 uint32_t player_get_current_bitrate(void)
 {
-    if (ctx.decoder != NULL) {
-        return ctx.decoder->get_current_bitrate();
+    return atomic_get(&ctx.bitrate);
+}
+
+uint32_t player_get_track_seq(void)
+{
+    return ctx.track_seq;
+}
+
+uint32_t player_get_underruns_count(void)
+{
+    return ctx.underruns;
+}
+
+void player_get_buffer_stats(player_buffer_stats_t *stats)
+{
+    if (stats == NULL) {
+        return;
     }
-    return 0;
+
+    stats->block_frames = ctx.block_frames;
+    stats->blocks_max = ctx.blocks_max;
+    stats->depth = ctx.depth;
+    stats->blocks_used = k_mem_slab_num_used_get(&ctx.i2s_mem_slab);
+    stats->decode_time_avg_us = ctx.decode_time_avg_us;
+    stats->decode_time_max_us = ctx.decode_time_max_us;
+    stats->read_time_avg_us = ctx.read_time_avg_us;
+    stats->read_time_max_us = ctx.read_time_max_us;
+    stats->underruns = ctx.underruns;
+    stats->seek_latency_ms = ctx.seek_latency_ms;
+
+    decoder_prefetch_stats_t prefetch_stats;
+    decoder_prefetch_get_stats(&prefetch_stats);
+    stats->prefetch_hits = prefetch_stats.hits;
+    stats->prefetch_stalls = prefetch_stats.stalls;
 }
@@ -11,12 +11,31 @@ typedef enum
     PLAYER_PLAYING
 } player_state_t;
 
+typedef struct
+{
+    size_t block_frames; // Frames per block, chosen per track
+    size_t blocks_max; // Blocks that fit in RAM budget for current block size
+    size_t depth; // Blocks currently allowed to be decoded ahead
+    size_t blocks_used; // Blocks currently decoded ahead
+    uint32_t decode_time_avg_us; // Per block, excluding storage reads
+    uint32_t decode_time_max_us;
+    uint32_t read_time_avg_us; // Per block
+    uint32_t read_time_max_us;
+    uint32_t underruns;
+    uint32_t seek_latency_ms; // From seek request to first block of audio queued, last seek
+    uint32_t prefetch_hits; // Storage reads served from read-ahead window, i.e. stalls avoided
+    uint32_t prefetch_stalls; // Storage reads decoder had to wait for
+} player_buffer_stats_t;
+
 void player_init(void);
 
 void player_start(const char *path);
+void player_set_next(const char *path); // Hint for gapless playback, NULL clears it
 void player_pause(void);
 void player_resume(void);
 void player_stop(void);
+void player_seek(size_t pcm_frame);
+void player_seek_relative(int32_t pcm_frames);
 
 void player_set_volume(uint8_t volume);
 
@@ -25,3 +44,6 @@ size_t player_get_pcm_frames_played(void);
 size_t player_get_pcm_frames_total(void);
 uint32_t player_get_pcm_sample_rate(void);
 uint32_t player_get_current_bitrate(void);
+uint32_t player_get_track_seq(void); // Changes when player has moved on to the next track by itself
+uint32_t player_get_underruns_count(void);
+void player_get_buffer_stats(player_buffer_stats_t *stats);
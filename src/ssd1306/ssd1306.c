@@ -1,10 +1,26 @@
 #include "ssd1306.h"
 #include <stdlib.h>
 #include <string.h>
+#include <zephyr/kernel.h>
 #include <zephyr/drivers/display.h>
+#include <zephyr/sys/util.h>
 
 #define SSD1306_PIXELS_PER_BYTE 8
+#define SSD1306_PAGE_HEIGHT 8 // Each byte of buffer is a column of 8 pixels of one page
+#define SSD1306_PAGES_MAX 8 // 64 rows, the tallest SSD1306 panel
+#define SSD1306_WIDTH_MAX 128
 
+#define SSD1306_FLUSH_THREAD_STACK_SIZE 1024
+#define SSD1306_FLUSH_THREAD_PRIORITY 11 // Below GUI thread, rendering never waits for I2C
+
+typedef struct
+{
+    uint16_t x_min; // Inclusive range of changed columns, x_min > x_max if page is clean
+    uint16_t x_max;
+} ssd1306_dirty_t;
+
+/* Drawing goes to back buffer (image_buffer), update copies its changed parts to front buffer,
+ * which flush thread sends to the display. Updates made during a flush are coalesced into the next one. */
 typedef struct
 {
     const struct device *display;
@@ -12,10 +28,80 @@ typedef struct
     uint8_t *image_buffer;
     uint16_t current_x;
     uint16_t current_y;
+    size_t pages;
+    ssd1306_dirty_t dirty[SSD1306_PAGES_MAX]; // Back buffer columns changed since last update
+    uint8_t *front_buffer;
+    ssd1306_dirty_t pending[SSD1306_PAGES_MAX]; // Front buffer columns not sent yet
+    struct k_mutex lock; // Protects front buffer, pending ranges and stats
+    struct k_sem flush_request;
+    struct k_thread flush_thread;
+    ssd1306_stats_t stats;
 } ssd1306_ctx_t;
 
 static ssd1306_ctx_t ctx;
 
+K_THREAD_STACK_DEFINE(flush_stack, SSD1306_FLUSH_THREAD_STACK_SIZE);
+
+static void range_clear(ssd1306_dirty_t *range)
+{
+    range->x_min = UINT16_MAX;
+    range->x_max = 0;
+}
+
+static bool range_is_empty(const ssd1306_dirty_t *range)
+{
+    return range->x_min > range->x_max;
+}
+
+static void range_add(ssd1306_dirty_t *range, uint16_t x_min, uint16_t x_max)
+{
+    range->x_min = MIN(range->x_min, x_min);
+    range->x_max = MAX(range->x_max, x_max);
+}
+
+static void mark_dirty(uint16_t x, size_t page)
+{
+    range_add(&ctx.dirty[page], x, x);
+}
+
+static void flush_task(void *p1, void *p2, void *p3)
+{
+    ARG_UNUSED(p1);
+    ARG_UNUSED(p2);
+    ARG_UNUSED(p3);
+
+    uint8_t page_buffer[SSD1306_WIDTH_MAX]; // Front buffer can be updated while page is being sent
+    struct display_buffer_descriptor desc = {.height = SSD1306_PAGE_HEIGHT};
+
+    while (1) {
+        k_sem_take(&ctx.flush_request, K_FOREVER);
+
+        for (size_t page = 0; page < ctx.pages; ++page) {
+            k_mutex_lock(&ctx.lock, K_FOREVER);
+
+            const ssd1306_dirty_t range = ctx.pending[page];
+            range_clear(&ctx.pending[page]);
+            if (range_is_empty(&range)) {
+                k_mutex_unlock(&ctx.lock);
+                continue;
+            }
+
+            desc.width = range.x_max - range.x_min + 1;
+            desc.pitch = desc.width;
+            desc.buf_size = desc.width;
+            memcpy(page_buffer, &ctx.front_buffer[(page * ctx.image_buffer_desc.width) + range.x_min], desc.buf_size);
+
+            ++ctx.stats.writes;
+            ctx.stats.bytes_sent += desc.buf_size;
+
+            k_mutex_unlock(&ctx.lock);
+
+            /* Blocks only this thread, I2C driver transfers the page with EasyDMA */
+            display_write(ctx.display, range.x_min, page * SSD1306_PAGE_HEIGHT, &desc, page_buffer);
+        }
+    }
+}
+
 int ssd1306_init(void)
 {
     ctx.display = DEVICE_DT_GET(DT_ALIAS(oled));
@@ -35,9 +121,31 @@ int ssd1306_init(void)
     ctx.image_buffer_desc.pitch = capabilities.x_resolution;
     ctx.image_buffer_desc.buf_size = ctx.image_buffer_desc.width * ctx.image_buffer_desc.height / SSD1306_PIXELS_PER_BYTE;
     ctx.image_buffer = malloc(ctx.image_buffer_desc.buf_size);
-    if (ctx.image_buffer == NULL) {
+    ctx.front_buffer = malloc(ctx.image_buffer_desc.buf_size);
+    if ((ctx.image_buffer == NULL) || (ctx.front_buffer == NULL) || (ctx.image_buffer_desc.width > SSD1306_WIDTH_MAX)) {
+        free(ctx.image_buffer);
+        free(ctx.front_buffer);
         return -ENOMEM;
     }
+    ctx.pages = MIN(ctx.image_buffer_desc.height / SSD1306_PAGE_HEIGHT, SSD1306_PAGES_MAX);
+    for (size_t page = 0; page < ctx.pages; ++page) {
+        range_clear(&ctx.pending[page]);
+    }
+
+    /* Start flush thread */
+    k_mutex_init(&ctx.lock);
+    k_sem_init(&ctx.flush_request, 0, 1);
+    k_thread_create(&ctx.flush_thread,
+                    flush_stack,
+                    K_THREAD_STACK_SIZEOF(flush_stack),
+                    flush_task,
+                    NULL,
+                    NULL,
+                    NULL,
+                    SSD1306_FLUSH_THREAD_PRIORITY,
+                    0,
+                    K_NO_WAIT);
+    k_thread_name_set(&ctx.flush_thread, "ssd1306_flush");
 
     /* Configure display */
     ssd1306_set_contrast(0xFF); // Maximum contrast
@@ -50,7 +158,9 @@ int ssd1306_init(void)
 
 void ssd1306_deinit(void)
 {
+    k_thread_abort(&ctx.flush_thread);
     free(ctx.image_buffer);
+    free(ctx.front_buffer);
 }
 
 void ssd1306_set_cursor(uint16_t x, uint16_t y)
@@ -66,12 +176,48 @@ void ssd1306_set_contrast(uint8_t value)
 
 void ssd1306_update_screen(void)
 {
-    display_write(ctx.display, 0, 0, &ctx.image_buffer_desc, ctx.image_buffer);
+    bool changed = false;
+
+    k_mutex_lock(&ctx.lock, K_FOREVER);
+
+    for (size_t page = 0; page < ctx.pages; ++page) {
+        ssd1306_dirty_t *dirty = &ctx.dirty[page];
+        if (range_is_empty(dirty)) {
+            continue;
+        }
+
+        /* Columns of a page are contiguous in buffer */
+        const size_t offset = (page * ctx.image_buffer_desc.width) + dirty->x_min;
+        memcpy(&ctx.front_buffer[offset], &ctx.image_buffer[offset], dirty->x_max - dirty->x_min + 1);
+        range_add(&ctx.pending[page], dirty->x_min, dirty->x_max);
+        range_clear(dirty);
+        changed = true;
+    }
+
+    ++ctx.stats.updates;
+
+    k_mutex_unlock(&ctx.lock);
+
+    /* Semaphore saturates at one, so that updates requested during a flush end up in a single next one */
+    if (changed) {
+        k_sem_give(&ctx.flush_request);
+    }
+}
+
+void ssd1306_get_stats(ssd1306_stats_t *stats)
+{
+    k_mutex_lock(&ctx.lock, K_FOREVER);
+    *stats = ctx.stats;
+    k_mutex_unlock(&ctx.lock);
 }
 
 void ssd1306_fill(ssd1306_color_t color)
 {
     memset(ctx.image_buffer, (color == SSD1306_BLACK) ? 0x00 : 0xFF, ctx.image_buffer_desc.buf_size);
+    for (size_t page = 0; page < ctx.pages; ++page) {
+        ctx.dirty[page].x_min = 0;
+        ctx.dirty[page].x_max = ctx.image_buffer_desc.width - 1;
+    }
 }
 
 void ssd1306_draw_pixel(uint16_t x, uint16_t y, ssd1306_color_t color)
@@ -81,38 +227,111 @@ void ssd1306_draw_pixel(uint16_t x, uint16_t y, ssd1306_color_t color)
         return;
     }
    
-    /* Draw pixel */
+    /* Draw pixel, page is marked dirty only if it actually changes */
+    uint8_t *byte = &ctx.image_buffer[x + (y / 8) * ctx.image_buffer_desc.width];
+    const uint8_t previous = *byte;
+
     if (color == SSD1306_WHITE) {
-        ctx.image_buffer[x + (y / 8) * ctx.image_buffer_desc.width] |= 1 << (y % 8);
+        *byte |= 1 << (y % 8);
     } 
     else { 
-        ctx.image_buffer[x + (y / 8) * ctx.image_buffer_desc.width] &= ~(1 << (y % 8));
+        *byte &= ~(1 << (y % 8));
+    }
+
+    if (*byte != previous) {
+        mark_dirty(x, y / SSD1306_PAGE_HEIGHT);
     }
 }
 
-char ssd1306_write_char(char ch, ssd1306_font_t font, ssd1306_color_t color)
+/* Copies columns as whole bytes, only changed ones mark page dirty */
+static void blit_columns(uint16_t x, size_t page, const uint8_t *columns, size_t count, uint8_t invert)
 {
-    char ch_to_show = ch;
-    
-    /* Check if character is printable */
-    if ((ch < 32) || (ch > 128)) {
-    	ch_to_show = '?'; // Display unknown chars as '?'
+    uint8_t *dest = &ctx.image_buffer[(page * ctx.image_buffer_desc.width) + x];
+    size_t first = count;
+    size_t last = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        const uint8_t column = columns[i] ^ invert;
+        if (dest[i] != column) {
+            dest[i] = column;
+            first = MIN(first, i);
+            last = i;
+        }
+    }
+
+    if (first < count) {
+        range_add(&ctx.dirty[page], x + first, x + last);
+    }
+}
+
+/* Copies glyph columns as whole bytes, cursor has to be page-aligned */
+static void blit_glyph(const uint8_t *columns, uint8_t width, ssd1306_color_t color)
+{
+    const uint8_t invert = (color == SSD1306_WHITE) ? 0x00 : 0xFF; // Background takes the opposite color
+    blit_columns(ctx.current_x, ctx.current_y / SSD1306_PAGE_HEIGHT, columns, width, invert);
+}
+
+static char get_printable(char ch)
+{
+    /* Display unknown chars as '?' */
+    return ((ch < 32) || (ch > 128)) ? '?' : ch;
+}
+
+void ssd1306_draw_columns(uint16_t x, uint16_t y, const uint8_t *columns, size_t count)
+{
+    /* Don't write outside the buffer */
+    if ((x >= ctx.image_buffer_desc.width) || ((y % SSD1306_PAGE_HEIGHT) != 0) || ((y / SSD1306_PAGE_HEIGHT) >= ctx.pages)) {
+        return;
+    }
+
+    blit_columns(x, y / SSD1306_PAGE_HEIGHT, columns, MIN(count, ctx.image_buffer_desc.width - x), 0x00);
+}
+
+size_t ssd1306_render_string(const char *str, ssd1306_font_t font, ssd1306_color_t color, uint8_t *columns, size_t size)
+{
+    const uint8_t invert = (color == SSD1306_WHITE) ? 0x00 : 0xFF;
+    size_t count = 0;
+
+    if ((font.columns == NULL) || (font.height != SSD1306_PAGE_HEIGHT)) {
+        return 0;
     }
+
+    while ((*str != '\0') && ((count + font.width) <= size)) {
+        const char ch = get_printable(*str++);
+        const uint8_t *glyph = &font.columns[(ch - 32) * font.width];
+        const uint8_t advance = font.char_width ? MIN(font.char_width[ch - 32], font.width) : font.width;
+
+        for (size_t i = 0; i < advance; ++i) {
+            columns[count++] = glyph[i] ^ invert;
+        }
+    }
+
+    return count;
+}
+
+char ssd1306_write_char(char ch, ssd1306_font_t font, ssd1306_color_t color)
+{
+    const char ch_to_show = get_printable(ch);
     
     /* Check remaining space in current line */
     if (((ctx.current_x + font.width) > ctx.image_buffer_desc.width) || ((ctx.current_y + font.height) > ctx.image_buffer_desc.height)) {
         return 0;
     }
     
-    /* Write char to buffer */
-    for (size_t i = 0; i < font.height; ++i) {
-        const uint16_t row_data = font.data[(ch_to_show - 32) * font.height + i];
-        for (size_t j = 0; j < font.width; ++j) {
-            if ((row_data << j) & 0x8000)  {
-                ssd1306_draw_pixel(ctx.current_x + j, (ctx.current_y + i), color);
-            } 
-            else {
-                ssd1306_draw_pixel(ctx.current_x + j, (ctx.current_y + i), !color);
+    /* Write char to buffer, pixel by pixel only if it's not aligned to page */
+    if ((font.columns != NULL) && (font.height == SSD1306_PAGE_HEIGHT) && ((ctx.current_y % SSD1306_PAGE_HEIGHT) == 0)) {
+        blit_glyph(&font.columns[(ch_to_show - 32) * font.width], font.width, color);
+    }
+    else {
+        for (size_t i = 0; i < font.height; ++i) {
+            const uint16_t row_data = font.data[(ch_to_show - 32) * font.height + i];
+            for (size_t j = 0; j < font.width; ++j) {
+                if ((row_data << j) & 0x8000)  {
+                    ssd1306_draw_pixel(ctx.current_x + j, (ctx.current_y + i), color);
+                } 
+                else {
+                    ssd1306_draw_pixel(ctx.current_x + j, (ctx.current_y + i), !color);
+                }
             }
         }
     }
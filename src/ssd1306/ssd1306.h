@@ -2,6 +2,7 @@
 
 #include "ssd1306_conf.h"
 #include <stdint.h>
+#include <stddef.h>
 // #include <stdbool.h>
 
 typedef enum 
@@ -16,8 +17,16 @@ typedef struct
 	const uint8_t height;               // Font height in pixels
 	const uint16_t *const data;         // Pointer to font data array
     const uint8_t *const char_width;    // Proportional character width in pixels (NULL for monospaced)
+    const uint8_t *const columns;       // Column-major glyphs, a byte per column, for fonts one page high (NULL if none)
 } ssd1306_font_t;
 
+typedef struct
+{
+    uint32_t updates;    // Requested by ssd1306_update_screen, several can be coalesced into one flush
+    uint32_t writes;     // Transfers issued to display
+    uint32_t bytes_sent; // Framebuffer bytes sent, without command overhead
+} ssd1306_stats_t;
+
 /* API */
 int ssd1306_init(void);
 void ssd1306_deinit(void);
@@ -25,9 +34,17 @@ void ssd1306_deinit(void);
 void ssd1306_set_cursor(uint16_t x, uint16_t y);
 void ssd1306_set_contrast(uint8_t value);
 
+/* Does not wait for the display. Only pages changed since previous update are sent by flush thread,
+ * each as a window spanning its changed columns. */
 void ssd1306_update_screen(void);
+void ssd1306_get_stats(ssd1306_stats_t *stats);
 
 void ssd1306_fill(ssd1306_color_t color);
 void ssd1306_draw_pixel(uint16_t x, uint16_t y, ssd1306_color_t color);
 char ssd1306_write_char(char ch, ssd1306_font_t font, ssd1306_color_t color);
 char ssd1306_write_string(const char *str, ssd1306_font_t font, ssd1306_color_t color);
+
+/* Page-high strips, a byte per column, for text that is rendered once and drawn many times.
+ * Rendering needs a font with columns, returns number of columns written, at most size. */
+size_t ssd1306_render_string(const char *str, ssd1306_font_t font, ssd1306_color_t color, uint8_t *columns, size_t size);
+void ssd1306_draw_columns(uint16_t x, uint16_t y, const uint8_t *columns, size_t count); // y has to be page-aligned
@@ -6,23 +6,88 @@
  */
 
 #include "dir.h"
+#include "dir_store.h"
 #include <string.h>
 #include <stdio.h>
 #include <zephyr/fs/fs.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
 #include <strnatcmp.h>
+#include <strnatxfrm.h>
 #include <utils.h>
+#include <stdlib.h>
+#include <ctype.h>
 #include <errno.h>
 
 #define DIR_PATH_MAX (255 + 1)
+#define DIR_ENTRIES_INITIAL_CAPACITY 32
+#define DIR_NAMES_INITIAL_CAPACITY 512
+#define DIR_SORT_FOLD_CASE true
+#define DIR_NAME_SIZE (MAX_FILE_NAME + 1)
+#define DIR_LIST_ENTRIES_MAX 1024 // Larger directories are listed in windows
+#define DIR_WINDOW_SIZE 32 // Has to be at least twice the number of entries fetched at once
+#define DIR_LIBRARY_BATCH 8 // Index entries read at once, has to divide window size
+
+#define DIR_SCAN_THREAD_STACK_SIZE (1024 * 2)
+#define DIR_SCAN_THREAD_PRIORITY 12 // Below GUI and player threads
+#define DIR_SCAN_THROTTLE_BATCH 16 // Entries read between pauses when throttled
+#define DIR_SCAN_THROTTLE_PAUSE_MS 5 // Lets player threads access the card
+
+typedef struct
+{
+	char *path; // NULL if entry is free
+	dir_list_t *list;
+	size_t cursor_index;
+	size_t size;
+	uint32_t last_used;
+} dir_cache_entry_t;
+
+/* Collation key of a single entry, used only while sorting */
+typedef struct
+{
+	uint32_t key_offset;
+	uint32_t key_size;
+	uint32_t name_offset; // Breaks ties of equal keys, same as compare_names
+	uint32_t index; // Position of entry in unsorted list
+} dir_sort_item_t;
 
 typedef struct
 {
 	char path[DIR_PATH_MAX];
+	size_t root_length; // Library index stores paths relative to root
 	size_t depth;
+	struct k_mutex sort_lock; // Scanner and window loads on GUI side may sort at once, protects two members below
+	const char *sort_names; // Names arena of list being sorted, qsort comparator has no context argument
+	const char *sort_keys; // Keys arena, as above
+	char pivot[DIR_NAME_SIZE]; // Entry next window is selected relative to, copied out as window gets overwritten
+
+	/* Recently visited directories */
+	dir_cache_entry_t cache[DIR_CACHE_ENTRIES_MAX];
+	uint32_t cache_clock; // Incremented on every use of cache entry, orders them for eviction
+	dir_cache_stats_t cache_stats;
+
+	/* Background scanning */
+	struct k_thread scan_thread;
+	struct k_mutex scan_lock; // Protects members below, up to atomics
+	struct k_sem scan_request;
+	char scan_path[DIR_PATH_MAX];
+	bool scan_pending; // Request not yet taken by scanner
+	bool scan_running;
+	bool scan_result_ready;
+	dir_list_t *scan_result;
+	atomic_t scan_cancel; // Set to abort scan in progress
+	atomic_t scan_throttle;
+	atomic_t scan_progress; // Entries read by scan in progress
 } dir_ctx_t;
 
 static dir_ctx_t ctx;
 
+BUILD_ASSERT(DIR_LIST_ENTRIES_MAX <= DIR_STORE_ENTRIES_MAX, "Every listing held at once has to fit listing store");
+
+K_THREAD_STACK_DEFINE(scan_stack, DIR_SCAN_THREAD_STACK_SIZE);
+
+LOG_MODULE_REGISTER(dir);
+
 static int path_append(const char *name)
 {
 	const size_t cur_path_len = strlen(ctx.path);
@@ -48,60 +113,293 @@ static int path_remove(void)
 	return 0;
 }
 
-static bool compare_ascending(const void *val1, const void *val2)
+/* Natural order, made total by falling back to plain comparison, so that windows never overlap */
+static int compare_names(const char *name1, const char *name2)
+{
+	const int result = DIR_SORT_FOLD_CASE ? strnatcasecmp(name1, name2) : strnatcmp(name1, name2);
+	if (result != 0) {
+		return result;
+	}
+	return strcmp(name1, name2);
+}
+
+static int compare_ascending(const void *val1, const void *val2)
 {
-	const struct fs_dirent *fno1 = val1;
-	const struct fs_dirent *fno2 = val2;
+	const dir_entry_t *entry1 = val1;
+	const dir_entry_t *entry2 = val2;
 
-	return (strnatcmp(fno1->name, fno2->name) > 0);
+	return compare_names(&ctx.sort_names[entry1->name_offset], &ctx.sort_names[entry2->name_offset]);
 }
 
-void dir_init(const char *root_path)
+static int compare_keys(const void *val1, const void *val2)
 {
-	utils_strlcpy(ctx.path, root_path, sizeof(ctx.path));
-	ctx.depth = 0;
+	const dir_sort_item_t *item1 = val1;
+	const dir_sort_item_t *item2 = val2;
+
+	const int result = memcmp(&ctx.sort_keys[item1->key_offset], &ctx.sort_keys[item2->key_offset], UTILS_MIN(item1->key_size, item2->key_size));
+	if (result != 0) {
+		return result;
+	}
+	if (item1->key_size != item2->key_size) {
+		return (item1->key_size > item2->key_size) ? 1 : -1;
+	}
+	return strcmp(&ctx.sort_names[item1->name_offset], &ctx.sort_names[item2->name_offset]);
 }
 
-int dir_enter(const char *name)
+/* Passes arenas to comparator, qsort_r is not declared the same way by every libc Zephyr builds with */
+static void sort_locked(void *base, size_t count, size_t size, int (*compare)(const void *, const void *), const char *names, const char *keys)
 {
-	const int ret = path_append(name);
-	if (ret) {
-		return ret;
+	k_mutex_lock(&ctx.sort_lock, K_FOREVER);
+	ctx.sort_names = names;
+	ctx.sort_keys = keys;
+	qsort(base, count, size, compare);
+	ctx.sort_names = NULL;
+	ctx.sort_keys = NULL;
+	k_mutex_unlock(&ctx.sort_lock);
+}
+
+/* Sorts by precomputed collation keys, so that names are parsed once instead of on every comparison */
+static int sort_by_keys(dir_list_t *list)
+{
+	dir_sort_item_t *items = malloc(list->count * sizeof(*items));
+	if (items == NULL) {
+		return -ENOMEM;
+	}
+
+	size_t keys_size = 0;
+	for (size_t i = 0; i < list->count; ++i) {
+		items[i].key_offset = keys_size;
+		items[i].key_size = strnatxfrm(NULL, &list->names[list->entries[i].name_offset], 0, DIR_SORT_FOLD_CASE);
+		items[i].name_offset = list->entries[i].name_offset;
+		items[i].index = i;
+		keys_size += items[i].key_size;
 	}
-	--ctx.depth;
+
+	char *keys = malloc(keys_size);
+	if (keys == NULL) {
+		free(items);
+		return -ENOMEM;
+	}
+
+	for (size_t i = 0; i < list->count; ++i) {
+		strnatxfrm(&keys[items[i].key_offset], &list->names[list->entries[i].name_offset], items[i].key_size, DIR_SORT_FOLD_CASE);
+	}
+
+	sort_locked(items, list->count, sizeof(*items), compare_keys, list->names, keys);
+
+	free(keys);
+
+	/* Apply permutation in place by following its cycles, done items are marked as fixed points */
+	for (size_t i = 0; i < list->count; ++i) {
+		if (items[i].index == i) {
+			continue;
+		}
+
+		const dir_entry_t first = list->entries[i];
+		size_t current = i;
+		while (items[current].index != i) {
+			const size_t source = items[current].index;
+			list->entries[current] = list->entries[source];
+			items[current].index = current;
+			current = source;
+		}
+		list->entries[current] = first;
+		items[current].index = current;
+	}
+
+	free(items);
 
 	return 0;
 }
 
-int dir_return(void)
+/* Linear check, far cheaper than sorting */
+static bool list_is_sorted(const dir_list_t *list)
 {
-	const int ret = path_remove();
-	if (ret) {
-		return ret;
+	for (size_t i = 1; i < list->count; ++i) {
+		if (compare_names(dir_entry_get_name(list, &list->entries[i - 1]), dir_entry_get_name(list, &list->entries[i])) > 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Called for every entry read, returns true if listing should be aborted. Window loads on GUI side are never aborted. */
+static bool scan_step(bool background, size_t entries)
+{
+	if (!background) {
+		return false;
+	}
+
+	atomic_set(&ctx.scan_progress, entries);
+
+	if (atomic_get(&ctx.scan_throttle) && ((entries % DIR_SCAN_THROTTLE_BATCH) == 0)) {
+		k_msleep(DIR_SCAN_THROTTLE_PAUSE_MS);
+	}
+
+	return atomic_get(&ctx.scan_cancel);
+}
+
+static int list_append(dir_list_t *list, const struct fs_dirent *entry)
+{
+	const size_t name_size = strlen(entry->name) + 1;
+
+	/* Grow geometrically, so that number of reallocations is logarithmic */
+	if (list->count == list->capacity) {
+		const size_t capacity = (list->capacity == 0) ? DIR_ENTRIES_INITIAL_CAPACITY : (list->capacity * 2);
+		dir_entry_t *entries = realloc(list->entries, capacity * sizeof(*entries));
+		if (entries == NULL) {
+			return -ENOMEM;
+		}
+		list->entries = entries;
+		list->capacity = capacity;
 	}
-	++ctx.depth;
+
+	if ((list->names_size + name_size) > list->names_capacity) {
+		size_t capacity = (list->names_capacity == 0) ? DIR_NAMES_INITIAL_CAPACITY : list->names_capacity;
+		while ((list->names_size + name_size) > capacity) {
+			capacity *= 2;
+		}
+		char *names = realloc(list->names, capacity);
+		if (names == NULL) {
+			return -ENOMEM;
+		}
+		list->names = names;
+		list->names_capacity = capacity;
+	}
+
+	dir_entry_t *record = &list->entries[list->count++];
+	record->name_offset = list->names_size;
+	record->size = entry->size;
+	record->type = entry->type;
+
+	memcpy(&list->names[list->names_size], entry->name, name_size);
+	list->names_size += name_size;
 
 	return 0;
 }
 
-const char *dir_get_fs_path(void)
+static void list_shrink(dir_list_t *list)
 {
-	return ctx.path;
+	/* Return unused capacity to the heap, shrinking realloc cannot fail in a harmful way */
+	if ((list->count > 0) && (list->count < list->capacity)) {
+		dir_entry_t *entries = realloc(list->entries, list->count * sizeof(*entries));
+		if (entries != NULL) {
+			list->entries = entries;
+			list->capacity = list->count;
+		}
+	}
+
+	if ((list->names_size > 0) && (list->names_size < list->names_capacity)) {
+		char *names = realloc(list->names, list->names_size);
+		if (names != NULL) {
+			list->names = names;
+			list->names_capacity = list->names_size;
+		}
+	}
+}
+
+/* Same as the first byte of collation key - digit runs start with a digit, letters are folded if sorting folds them */
+static size_t prefix_bucket(unsigned char c)
+{
+	if (DIR_SORT_FOLD_CASE) {
+		c = toupper(c);
+	}
+	if (c < 'A') {
+		return 0;
+	}
+	if (c <= 'Z') {
+		return 1 + (c - 'A');
+	}
+	return DIR_PREFIX_BUCKETS - 1;
+}
+
+/* Turns per-bucket counts into first entry indices, buckets follow each other in sort order */
+static void prefix_finish(uint32_t *prefix_index)
+{
+	uint32_t first = 0;
+
+	for (size_t i = 0; i < DIR_PREFIX_BUCKETS; ++i) {
+		const uint32_t count = prefix_index[i];
+		prefix_index[i] = first;
+		first += count;
+	}
+}
+
+static void prefix_build(dir_list_t *list)
+{
+	memset(list->prefix_index, 0, sizeof(list->prefix_index));
+	for (size_t i = 0; i < list->count; ++i) {
+		++list->prefix_index[dir_prefix_get_bucket(dir_entry_get_name(list, &list->entries[i]))];
+	}
+	prefix_finish(list->prefix_index);
+}
+
+/* Window is selected into a heap whose root is the entry farthest from pivot, i.e. the first to be evicted */
+static int heap_compare(const dir_list_t *list, size_t i, size_t j, bool forward)
+{
+	const int result = compare_names(dir_entry_get_name(list, &list->entries[i]), dir_entry_get_name(list, &list->entries[j]));
+	return forward ? result : -result;
+}
+
+static void heap_swap(dir_list_t *list, size_t i, size_t j)
+{
+	const dir_entry_t entry = list->entries[i];
+	list->entries[i] = list->entries[j];
+	list->entries[j] = entry;
+}
+
+static void heap_sift_up(dir_list_t *list, size_t i, bool forward)
+{
+	while (i > 0) {
+		const size_t parent = (i - 1) / 2;
+		if (heap_compare(list, i, parent, forward) <= 0) {
+			break;
+		}
+		heap_swap(list, i, parent);
+		i = parent;
+	}
+}
+
+static void heap_sift_down(dir_list_t *list, size_t i, bool forward)
+{
+	while (1) {
+		const size_t left = (2 * i) + 1;
+		const size_t right = left + 1;
+		size_t top = i;
+
+		if ((left < list->count) && (heap_compare(list, left, top, forward) > 0)) {
+			top = left;
+		}
+		if ((right < list->count) && (heap_compare(list, right, top, forward) > 0)) {
+			top = right;
+		}
+		if (top == i) {
+			break;
+		}
+		heap_swap(list, i, top);
+		i = top;
+	}
 }
 
-dir_list_t *dir_list(void)
+/* Reads the whole directory, keeping DIR_WINDOW_SIZE entries closest to pivot - starting with it if forward
+ * is set, ending with it otherwise. Entries of buckets before the given one (after it if not forward) are
+ * skipped as well, so without pivot the window starts or ends at the bucket boundary. */
+static int window_select(dir_list_t *list, const char *pivot, size_t bucket, bool forward, bool background)
 {
 	int err;
 	struct fs_dir_t dirp;
 	struct fs_dirent entry;
+	size_t preceding = 0; // Entries before the window
+	uint32_t prefix_index[DIR_PREFIX_BUCKETS] = {0}; // Rebuilt by every pass, kept only if it completes
 
 	fs_dir_t_init(&dirp);
-	err = fs_opendir(&dirp, ctx.path);
+	err = fs_opendir(&dirp, list->path);
 	if (err) {
-		return NULL;
+		return err;
 	}
 
-	dir_list_t *list = list_create();
+	list->count = 0;
+	list->total = 0;
 
 	while (1) {
 		err = fs_readdir(&dirp, &entry);
@@ -109,60 +407,1029 @@ dir_list_t *dir_list(void)
 			break;
 		}
 
-		list_add(list, &entry, sizeof(entry), LIST_PREPEND);
-	}
+		const size_t entry_bucket = dir_prefix_get_bucket(entry.name);
+		++list->total;
+		++prefix_index[entry_bucket];
+
+		if (scan_step(background, list->total)) {
+			err = -ECANCELED;
+			break;
+		}
+
+		bool outside = forward ? (entry_bucket < bucket) : (entry_bucket > bucket);
+		if (!outside && (pivot != NULL)) {
+			const int result = compare_names(entry.name, pivot);
+			outside = forward ? (result < 0) : (result > 0);
+		}
+		if (outside) {
+			preceding += forward ? 1 : 0;
+			continue;
+		}
+		if (!forward) {
+			++preceding;
+		}
+
+		size_t slot;
+		if (list->count < DIR_WINDOW_SIZE) {
+			slot = list->count++;
+			list->entries[slot].name_offset = slot * DIR_NAME_SIZE;
+		}
+		else {
+			/* Window is full, new entry replaces root if it is closer to pivot */
+			const int result = compare_names(entry.name, dir_entry_get_name(list, &list->entries[0]));
+			if (forward ? (result >= 0) : (result <= 0)) {
+				continue;
+			}
+			slot = 0;
+		}
 
-	/* Sort naturally ascending */
-	list_sort(list, compare_ascending);
+		dir_entry_t *record = &list->entries[slot];
+		record->size = entry.size;
+		record->type = entry.type;
+		utils_strlcpy(&list->names[record->name_offset], entry.name, DIR_NAME_SIZE);
+
+		if (slot == 0) {
+			heap_sift_down(list, slot, forward);
+		}
+		else {
+			heap_sift_up(list, slot, forward);
+		}
+	}
 
 	fs_closedir(&dirp);
 
-	return list;
+	if (err) {
+		return err;
+	}
+	if (list->count == 0) {
+		return -ENOENT;
+	}
+
+	/* Preceding entries counted backward are the ones kept or before them */
+	list->window_offset = forward ? preceding : (preceding - list->count);
+
+	prefix_finish(prefix_index);
+	memcpy(list->prefix_index, prefix_index, sizeof(list->prefix_index));
+
+	sort_locked(list->entries, list->count, sizeof(*list->entries), compare_ascending, list->names, NULL);
+
+	return 0;
 }
 
-dir_entry_t *dir_get_prev(dir_list_t *list, dir_entry_t *current)
+/* Reads window centered on given entry straight from library index */
+static int window_read_library(dir_list_t *list, size_t index)
 {
-	if ((list == NULL) || (current == NULL)) {
-		return NULL;
+	library_entry_t records[DIR_LIBRARY_BATCH];
+	const size_t half = DIR_WINDOW_SIZE / 2;
+	const size_t start = UTILS_MIN((index > half) ? (index - half) : 0, list->total - DIR_WINDOW_SIZE);
+
+	list->count = 0;
+
+	for (size_t i = 0; i < DIR_WINDOW_SIZE; i += DIR_LIBRARY_BATCH) {
+		const int err = library_read_entries(&list->library_dir, start + i, records, DIR_LIBRARY_BATCH);
+		if (err) {
+			return err;
+		}
+
+		for (size_t j = 0; j < DIR_LIBRARY_BATCH; ++j) {
+			dir_entry_t *entry = &list->entries[i + j];
+			entry->name_offset = (i + j) * DIR_NAME_SIZE;
+			entry->size = records[j].size;
+			entry->type = records[j].type;
+
+			/* Names are null-terminated in index, this only bounds them */
+			char *name = &list->names[entry->name_offset];
+			const ssize_t bytes_read = library_read_strings(records[j].name_offset, name, DIR_NAME_SIZE - 1);
+			if (bytes_read < 0) {
+				return bytes_read;
+			}
+			name[bytes_read] = '\0';
+		}
 	}
 
-	dir_entry_t *entry = list->head;
-	do {
-		if (entry->data == current->data) {
-			break;
+	list->count = DIR_WINDOW_SIZE;
+	list->window_offset = start;
+
+	return 0;
+}
+
+/* The last bucket starting at or before given entry, empty ones preceding it start at the same index */
+static size_t prefix_find(const dir_list_t *list, size_t index)
+{
+	size_t low = 0;
+	size_t high = DIR_PREFIX_BUCKETS;
+	while ((high - low) > 1) {
+		const size_t middle = (low + high) / 2;
+		if (list->prefix_index[middle] <= index) {
+			low = middle;
+		}
+		else {
+			high = middle;
 		}
-		entry = entry->next;
+	}
+	return low;
+}
+
+static size_t prefix_get_end(const dir_list_t *list, size_t bucket)
+{
+	return (bucket < (DIR_PREFIX_BUCKETS - 1)) ? list->prefix_index[bucket + 1] : list->total;
+}
+
+/* Name of entry that window was moved away from, kept after window's names in arena */
+static char *window_get_anchor(dir_list_t *list)
+{
+	return &list->names[DIR_WINDOW_SIZE * DIR_NAME_SIZE];
+}
 
-	} while (entry != NULL);
+/* Window that neither starts nor ends at bucket boundary is costly to get back to, so its first entry is remembered */
+static void window_save_anchor(dir_list_t *list)
+{
+	if (list->count == 0) {
+		return;
+	}
 
-	if ((entry == NULL) || (entry->prev == NULL)) {
-		return list->tail;
+	const size_t window_end = list->window_offset + list->count;
+	const size_t first_bucket = prefix_find(list, list->window_offset);
+	const size_t last_bucket = prefix_find(list, window_end - 1);
+	if ((list->window_offset == list->prefix_index[first_bucket]) || (window_end == prefix_get_end(list, last_bucket))) {
+		return;
 	}
-	return entry->prev;
+
+	utils_strlcpy(window_get_anchor(list), dir_entry_get_name(list, &list->entries[0]), DIR_NAME_SIZE);
+	list->anchor_index = list->window_offset;
 }
 
-dir_entry_t *dir_get_next(dir_list_t *list, dir_entry_t *current)
+/* Selects window with requested entries in its middle in a single pass, bounded by an entry of current window,
+ * by the entry it was last moved away from or by a bucket boundary, whichever lets it reach there. Only entries deep
+ * inside a bucket far larger than window and away from those take more passes, each moving window by its whole size. */
+static int window_load(dir_list_t *list, size_t index, size_t count)
 {
-	if ((list == NULL) || (current == NULL)) {
-		return NULL;
+	if (list->path == NULL) {
+		return 0;
 	}
 
-	dir_entry_t *entry = list->head;
-	do {
-		if (entry->data == current->data) {
-			break;
+	const size_t end = UTILS_MIN(index + count, list->total);
+
+	if (list->indexed) {
+		if ((index >= list->window_offset) && (end <= (list->window_offset + list->count))) {
+			return 0;
+		}
+		return window_read_library(list, index);
+	}
+
+	while ((index < list->window_offset) || (end > (list->window_offset + list->count))) {
+		int err;
+
+		/* Directory changed since it was counted, cursor is past its end */
+		if (index >= list->total) {
+			return -EIO;
+		}
+
+		const size_t size = UTILS_MIN(DIR_WINDOW_SIZE, list->total);
+		const size_t middle = (index + end) / 2;
+		const size_t start = UTILS_MIN((middle > (size / 2)) ? (middle - (size / 2)) : 0, list->total - size);
+		const size_t window_end = list->window_offset + list->count;
+		const size_t anchor = list->anchor_index;
+		const size_t first_bucket = prefix_find(list, index);
+		const size_t last_bucket = prefix_find(list, end - 1);
+		const size_t bucket_start = list->prefix_index[first_bucket];
+		const size_t bucket_end = prefix_get_end(list, last_bucket);
+
+		const char *pivot = NULL;
+		size_t bucket = 0;
+		bool forward = true;
+		bool moves_away = true; // New window is not adjacent to current one
+
+		if ((start == 0) || ((start + size) == list->total)) {
+			bucket = (start == 0) ? 0 : (DIR_PREFIX_BUCKETS - 1);
+			forward = (start == 0);
+		}
+		else if ((start >= list->window_offset) && (start < window_end)) {
+			pivot = dir_entry_get_name(list, &list->entries[start - list->window_offset]);
+			moves_away = false;
+		}
+		else if (((start + size) > list->window_offset) && ((start + size) <= window_end)) {
+			pivot = dir_entry_get_name(list, &list->entries[start + size - 1 - list->window_offset]);
+			bucket = DIR_PREFIX_BUCKETS - 1;
+			forward = false;
+			moves_away = false;
+		}
+		else if ((anchor != SIZE_MAX) && (anchor <= index) && (end <= (anchor + size))) {
+			pivot = window_get_anchor(list);
+		}
+		else if ((anchor != SIZE_MAX) && (end <= (anchor + 1)) && ((index + size) > anchor)) {
+			pivot = window_get_anchor(list);
+			bucket = DIR_PREFIX_BUCKETS - 1;
+			forward = false;
+		}
+		else if (end <= (bucket_start + size)) {
+			bucket = first_bucket;
+		}
+		else if ((index + size) >= bucket_end) {
+			bucket = last_bucket;
+			forward = false;
+		}
+		else {
+			/* Step from the nearest of bucket boundaries, current window and anchor */
+			size_t distance = index - bucket_start;
+			bucket = first_bucket;
+
+			if ((bucket_end - end) < distance) {
+				distance = bucket_end - end;
+				bucket = last_bucket;
+				forward = false;
+			}
+			if ((anchor != SIZE_MAX) && (anchor <= index) && ((index - anchor) < distance)) {
+				distance = index - anchor;
+				pivot = window_get_anchor(list);
+				bucket = 0;
+				forward = true;
+			}
+			if ((anchor != SIZE_MAX) && (anchor >= end) && ((anchor - end) < distance)) {
+				distance = anchor - end;
+				pivot = window_get_anchor(list);
+				bucket = DIR_PREFIX_BUCKETS - 1;
+				forward = false;
+			}
+			if ((list->count > 0) && (index >= window_end) && ((index - window_end) < distance)) {
+				distance = index - window_end;
+				pivot = dir_entry_get_name(list, &list->entries[list->count - 1]);
+				bucket = 0;
+				forward = true;
+				moves_away = false;
+			}
+			if ((list->count > 0) && (end <= list->window_offset) && ((list->window_offset - end) < distance)) {
+				pivot = dir_entry_get_name(list, &list->entries[0]);
+				bucket = DIR_PREFIX_BUCKETS - 1;
+				forward = false;
+				moves_away = false;
+			}
+		}
+
+		/* Pivot is copied out, as both window and anchor are about to be overwritten */
+		if (pivot != NULL) {
+			utils_strlcpy(ctx.pivot, pivot, sizeof(ctx.pivot));
+			pivot = ctx.pivot;
+		}
+		if (moves_away) {
+			window_save_anchor(list);
+		}
+
+		const size_t previous_offset = list->window_offset;
+		const size_t previous_count = list->count;
+
+		err = window_select(list, pivot, bucket, forward, false);
+		if (err) {
+			LOG_ERR("Failed to read window at %u, error %d", index, err);
+			return err;
+		}
+
+		/* The same window is selected again only if directory shrank after it was counted, it would never get there */
+		if ((list->window_offset == previous_offset) && (list->count == previous_count)) {
+			LOG_ERR("Window at %u does not move, directory changed", index);
+			return -EIO;
 		}
-		entry = entry->next;
+	}
+
+	return 0;
+}
 
-	} while (entry != NULL);
+static void list_free_storage(dir_list_t *list)
+{
+	free(list->entries);
+	free(list->names);
+	free(list->path);
+}
+
+static int list_alloc_window(dir_list_t *list, const char *path)
+{
+	list_free_storage(list);
+	memset(list, 0, sizeof(*list));
 
-	if ((entry == NULL) || (entry->next == NULL)) {
-		return list->head;
+	list->path = malloc(strlen(path) + 1);
+	list->entries = malloc(DIR_WINDOW_SIZE * sizeof(*list->entries));
+	list->names = malloc((DIR_WINDOW_SIZE + 1) * DIR_NAME_SIZE);
+	if ((list->path == NULL) || (list->entries == NULL) || (list->names == NULL)) {
+		return -ENOMEM;
 	}
-	return entry->next;
+
+	strcpy(list->path, path);
+	list->capacity = DIR_WINDOW_SIZE;
+	list->names_capacity = (DIR_WINDOW_SIZE + 1) * DIR_NAME_SIZE;
+	list->anchor_index = SIZE_MAX;
+
+	return 0;
 }
 
-void dir_list_free(dir_list_t *list)
+static int list_init_windowed(dir_list_t *list, const char *path, bool background)
+{
+	const int err = list_alloc_window(list, path);
+	if (err) {
+		return err;
+	}
+	return window_select(list, NULL, 0, true, background);
+}
+
+/* Root of card is checked by library_init, directories below it are trusted if their first and last entry still exist, with the same size */
+static bool library_dir_is_current(const char *path, const library_dir_t *dir)
+{
+	library_entry_t record;
+	struct fs_dirent entry;
+	char entry_path[DIR_PATH_MAX + DIR_NAME_SIZE];
+
+	if (dir->entries_count == 0) {
+		return true;
+	}
+
+	const size_t checked[] = {0, dir->entries_count - 1};
+	for (size_t i = 0; i < ARRAY_SIZE(checked); ++i) {
+		if (library_read_entries(dir, checked[i], &record, 1) != 0) {
+			return false;
+		}
+
+		const size_t path_length = snprintf(entry_path, sizeof(entry_path), "%s/", path);
+		const ssize_t bytes_read = library_read_strings(record.name_offset, &entry_path[path_length], sizeof(entry_path) - path_length - 1);
+		if (bytes_read <= 0) {
+			return false;
+		}
+		entry_path[path_length + bytes_read] = '\0';
+
+		if ((fs_stat(entry_path, &entry) != 0) || (entry.type != record.type) ||
+			((entry.type == FS_DIR_ENTRY_FILE) && (entry.size != record.size))) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/* Streams names of indexed directory through names arena of window, before the window is read into it */
+static int prefix_build_library(dir_list_t *list)
+{
+	const library_dir_t *dir = &list->library_dir;
+	bool name_start = true;
+
+	memset(list->prefix_index, 0, sizeof(list->prefix_index));
+
+	for (uint32_t offset = 0; offset < dir->names_size;) {
+		const ssize_t bytes_read = library_read_strings(dir->names_offset + offset, list->names,
+														UTILS_MIN(list->names_capacity, dir->names_size - offset));
+		if (bytes_read <= 0) {
+			return -EIO;
+		}
+
+		for (ssize_t i = 0; i < bytes_read; ++i) {
+			const unsigned char c = list->names[i];
+			if (name_start && ((c == '\0') || !isspace(c))) {
+				++list->prefix_index[prefix_bucket(c)];
+				name_start = (c == '\0');
+			}
+			else if (c == '\0') {
+				name_start = true;
+			}
+		}
+
+		offset += bytes_read;
+	}
+
+	prefix_finish(list->prefix_index);
+
+	return 0;
+}
+
+static int list_read_library(dir_list_t *list)
+{
+	library_entry_t records[DIR_LIBRARY_BATCH];
+	const library_dir_t *dir = &list->library_dir;
+
+	if (dir->entries_count == 0) {
+		return 0;
+	}
+
+	list->entries = malloc(dir->entries_count * sizeof(*list->entries));
+	list->names = malloc(dir->names_size);
+	if ((list->entries == NULL) || (list->names == NULL)) {
+		return -ENOMEM;
+	}
+	list->capacity = dir->entries_count;
+	list->names_capacity = dir->names_size;
+	list->names_size = dir->names_size;
+
+	/* Names of a directory are stored contiguously, so they're read at once */
+	if (library_read_strings(dir->names_offset, list->names, dir->names_size) != (ssize_t)dir->names_size) {
+		return -EIO;
+	}
+
+	for (size_t i = 0; i < dir->entries_count; i += DIR_LIBRARY_BATCH) {
+		const size_t batch = UTILS_MIN(DIR_LIBRARY_BATCH, dir->entries_count - i);
+		const int err = library_read_entries(dir, i, records, batch);
+		if (err) {
+			return err;
+		}
+
+		for (size_t j = 0; j < batch; ++j) {
+			if ((records[j].name_offset < dir->names_offset) || (records[j].name_offset >= (dir->names_offset + dir->names_size))) {
+				return -EIO;
+			}
+
+			dir_entry_t *entry = &list->entries[i + j];
+			entry->name_offset = records[j].name_offset - dir->names_offset;
+			entry->size = records[j].size;
+			entry->type = records[j].type;
+		}
+	}
+
+	list->count = dir->entries_count;
+	prefix_build(list);
+
+	return 0;
+}
+
+/* Returns NULL if directory is not indexed or index does not match the card anymore */
+static dir_list_t *list_library(const char *path)
 {
-	list_destroy(list);
+	library_dir_t dir;
+
+	if (library_find_dir(&path[ctx.root_length], &dir) != 0) {
+		return NULL;
+	}
+
+	if (!library_dir_is_current(path, &dir)) {
+		LOG_WRN("Library index is stale for %s, listing it from card", path);
+		return NULL;
+	}
+
+	dir_list_t *list = calloc(1, sizeof(*list));
+	if (list == NULL) {
+		return NULL;
+	}
+
+	int err;
+	if (dir.entries_count > DIR_LIST_ENTRIES_MAX) {
+		err = list_alloc_window(list, path);
+		list->indexed = true;
+		list->library_dir = dir;
+		list->total = dir.entries_count;
+		if (!err) {
+			err = prefix_build_library(list);
+		}
+		if (!err) {
+			err = window_read_library(list, 0);
+		}
+	}
+	else {
+		list->indexed = true;
+		list->library_dir = dir;
+		list->total = dir.entries_count;
+		err = list_read_library(list);
+	}
+
+	if (err) {
+		dir_list_free(list);
+		return NULL;
+	}
+
+	return list;
+}
+
+static size_t list_get_size(const dir_list_t *list)
+{
+	size_t size = sizeof(*list) + (list->capacity * sizeof(*list->entries)) + list->names_capacity;
+	if (list->path != NULL) {
+		size += strlen(list->path) + 1;
+	}
+	return size;
+}
+
+static dir_cache_entry_t *cache_find(const char *path)
+{
+	for (size_t i = 0; i < DIR_CACHE_ENTRIES_MAX; ++i) {
+		if ((ctx.cache[i].path != NULL) && (strcmp(ctx.cache[i].path, path) == 0)) {
+			return &ctx.cache[i];
+		}
+	}
+	return NULL;
+}
+
+/* Returns least recently used entry other than the excluded one, NULL if there's none */
+static dir_cache_entry_t *cache_find_lru(const dir_cache_entry_t *excluded)
+{
+	dir_cache_entry_t *lru = NULL;
+	for (size_t i = 0; i < DIR_CACHE_ENTRIES_MAX; ++i) {
+		dir_cache_entry_t *entry = &ctx.cache[i];
+		if ((entry->path == NULL) || (entry == excluded)) {
+			continue;
+		}
+		if ((lru == NULL) || ((int32_t)(entry->last_used - lru->last_used) < 0)) {
+			lru = entry;
+		}
+	}
+	return lru;
+}
+
+/* Frees entry, freeing its listing too if it's still owned by cache */
+static void cache_remove(dir_cache_entry_t *entry, bool free_list)
+{
+	if (free_list) {
+		dir_list_free(entry->list);
+	}
+	free(entry->path);
+	ctx.cache_stats.size -= entry->size;
+	memset(entry, 0, sizeof(*entry));
+}
+
+static void cache_evict(dir_cache_entry_t *entry)
+{
+	cache_remove(entry, true);
+	++ctx.cache_stats.evictions;
+}
+
+static dir_list_t *list_path(const char *path, bool background)
+{
+	int err;
+	struct fs_dir_t dirp;
+	struct fs_dirent entry;
+
+	const uint32_t start_tick = k_uptime_get_32();
+
+	dir_list_t *list = list_library(path);
+	if (list != NULL) {
+		LOG_INF("Listed %u entries from library index in %u ms", list->total, k_uptime_get_32() - start_tick);
+		return list;
+	}
+
+	fs_dir_t_init(&dirp);
+	err = fs_opendir(&dirp, path);
+	if (err) {
+		return NULL;
+	}
+
+	list = calloc(1, sizeof(*list));
+	if (list == NULL) {
+		fs_closedir(&dirp);
+		return NULL;
+	}
+
+	bool windowed = false;
+	bool cancelled = false;
+	while (1) {
+		err = fs_readdir(&dirp, &entry);
+		if ((err != 0) || (entry.name[0] == '\0')) {
+			break;
+		}
+
+		if (list->count == DIR_LIST_ENTRIES_MAX) {
+			windowed = true;
+			break;
+		}
+
+		if (list_append(list, &entry) != 0) {
+			break; // Out of memory, show as much as fits
+		}
+
+		if (scan_step(background, list->count)) {
+			cancelled = true;
+			break;
+		}
+	}
+
+	fs_closedir(&dirp);
+
+	if (cancelled) {
+		dir_list_free(list);
+		return NULL;
+	}
+
+	if (windowed) {
+		if (list_init_windowed(list, path, background) != 0) {
+			dir_list_free(list);
+			return NULL;
+		}
+	}
+	else {
+		list_shrink(list);
+		list->total = list->count;
+
+		dir_store_fingerprint_t fingerprint;
+		dir_store_fingerprint(list, &fingerprint);
+
+		/* Listing sorted on one of previous boots spares sorting it again, unless directory is read in different order now */
+		if ((dir_store_load(path, &fingerprint, list) != 0) || !list_is_sorted(list)) {
+			/* Sort naturally ascending, compare names directly if there's no memory for keys */
+			if ((list->count > 1) && (sort_by_keys(list) != 0)) {
+				sort_locked(list->entries, list->count, sizeof(*list->entries), compare_ascending, list->names, NULL);
+			}
+			dir_store_save(path, &fingerprint, list);
+		}
+
+		prefix_build(list);
+	}
+
+	LOG_INF("Listed %u entries%s in %u ms", list->total, windowed ? " (windowed)" : "", k_uptime_get_32() - start_tick);
+
+	return list;
+}
+
+static void scan_task(void *p1, void *p2, void *p3)
+{
+	ARG_UNUSED(p1);
+	ARG_UNUSED(p2);
+	ARG_UNUSED(p3);
+
+	char path[DIR_PATH_MAX];
+
+	while (1) {
+		k_sem_take(&ctx.scan_request, K_FOREVER);
+
+		k_mutex_lock(&ctx.scan_lock, K_FOREVER);
+		if (!ctx.scan_pending) {
+			k_mutex_unlock(&ctx.scan_lock);
+			continue;
+		}
+		utils_strlcpy(path, ctx.scan_path, sizeof(path));
+		ctx.scan_pending = false;
+		ctx.scan_running = true;
+		atomic_clear(&ctx.scan_cancel);
+		atomic_clear(&ctx.scan_progress);
+		k_mutex_unlock(&ctx.scan_lock);
+
+		dir_list_t *list = list_path(path, true);
+
+		/* Result of cancelled scan is dropped, newer request may already be pending */
+		k_mutex_lock(&ctx.scan_lock, K_FOREVER);
+		ctx.scan_running = false;
+		if (!atomic_get(&ctx.scan_cancel) && !ctx.scan_pending) {
+			ctx.scan_result = list;
+			ctx.scan_result_ready = true;
+			list = NULL;
+		}
+		k_mutex_unlock(&ctx.scan_lock);
+
+		dir_list_free(list);
+	}
+}
+
+void dir_init(const char *root_path)
+{
+	utils_strlcpy(ctx.path, root_path, sizeof(ctx.path));
+	ctx.root_length = strlen(ctx.path);
+	ctx.depth = 0;
+
+	/* Listings are still sorted in RAM if there's no flash store */
+	dir_store_init();
+
+	k_mutex_init(&ctx.sort_lock);
+	k_mutex_init(&ctx.scan_lock);
+	k_sem_init(&ctx.scan_request, 0, 1);
+
+	k_thread_create(&ctx.scan_thread,
+					scan_stack,
+					K_THREAD_STACK_SIZEOF(scan_stack),
+					scan_task,
+					NULL,
+					NULL,
+					NULL,
+					DIR_SCAN_THREAD_PRIORITY,
+					0,
+					K_NO_WAIT);
+	k_thread_name_set(&ctx.scan_thread, "dir_scan");
+}
+
+int dir_enter(const char *name)
+{
+	const int ret = path_append(name);
+	if (ret) {
+		return ret;
+	}
+	--ctx.depth;
+
+	return 0;
+}
+
+int dir_return(void)
+{
+	const int ret = path_remove();
+	if (ret) {
+		return ret;
+	}
+	++ctx.depth;
+
+	return 0;
+}
+
+const char *dir_get_fs_path(void)
+{
+	return ctx.path;
+}
+
+int dir_cache_put(dir_list_t *list, size_t cursor_index)
+{
+	if (list == NULL) {
+		return 0;
+	}
+
+	/* Allocated first, so that cache stays untouched on failure */
+	char *path = malloc(strlen(ctx.path) + 1);
+	if (path == NULL) {
+		return -ENOMEM;
+	}
+
+	/* Older listing of the same directory is replaced */
+	dir_cache_entry_t *entry = cache_find(ctx.path);
+	if (entry != NULL) {
+		cache_remove(entry, (entry->list != list));
+	}
+
+	entry = NULL;
+	for (size_t i = 0; i < DIR_CACHE_ENTRIES_MAX; ++i) {
+		if (ctx.cache[i].path == NULL) {
+			entry = &ctx.cache[i];
+			break;
+		}
+	}
+	if (entry == NULL) {
+		entry = cache_find_lru(NULL);
+		cache_evict(entry);
+	}
+
+	entry->path = path;
+	strcpy(entry->path, ctx.path);
+	entry->list = list;
+	entry->cursor_index = cursor_index;
+	entry->size = list_get_size(list);
+	entry->last_used = ++ctx.cache_clock;
+	ctx.cache_stats.size += entry->size;
+
+	/* Make room, the new entry stays even if it alone exceeds the limit */
+	while (ctx.cache_stats.size > DIR_CACHE_SIZE_MAX) {
+		dir_cache_entry_t *lru = cache_find_lru(entry);
+		if (lru == NULL) {
+			break;
+		}
+		cache_evict(lru);
+	}
+
+	return 0;
+}
+
+dir_list_t *dir_cache_get(size_t *cursor_index)
+{
+	dir_cache_entry_t *entry = cache_find(ctx.path);
+	if (entry == NULL) {
+		++ctx.cache_stats.misses;
+		LOG_DBG("Cache miss, %u hits, %u misses", ctx.cache_stats.hits, ctx.cache_stats.misses);
+		return NULL;
+	}
+
+	++ctx.cache_stats.hits;
+	LOG_DBG("Cache hit, %u hits, %u misses", ctx.cache_stats.hits, ctx.cache_stats.misses);
+
+	/* Listing in use is not cached, so that it can't be evicted */
+	dir_list_t *list = entry->list;
+	*cursor_index = entry->cursor_index;
+	cache_remove(entry, false);
+
+	return list;
+}
+
+void dir_cache_get_stats(dir_cache_stats_t *stats)
+{
+	*stats = ctx.cache_stats;
+}
+
+void dir_scan_start(void)
+{
+	k_mutex_lock(&ctx.scan_lock, K_FOREVER);
+	utils_strlcpy(ctx.scan_path, ctx.path, sizeof(ctx.scan_path));
+	ctx.scan_pending = true;
+	dir_list_free(ctx.scan_result);
+	ctx.scan_result = NULL;
+	ctx.scan_result_ready = false;
+	atomic_set(&ctx.scan_cancel, true);
+	k_mutex_unlock(&ctx.scan_lock);
+
+	k_sem_give(&ctx.scan_request);
+}
+
+void dir_scan_cancel(void)
+{
+	k_mutex_lock(&ctx.scan_lock, K_FOREVER);
+	ctx.scan_pending = false;
+	dir_list_free(ctx.scan_result);
+	ctx.scan_result = NULL;
+	ctx.scan_result_ready = false;
+	atomic_set(&ctx.scan_cancel, true);
+	k_mutex_unlock(&ctx.scan_lock);
+}
+
+int dir_scan_get_result(dir_list_t **list)
+{
+	int ret;
+
+	k_mutex_lock(&ctx.scan_lock, K_FOREVER);
+	if (ctx.scan_result_ready) {
+		*list = ctx.scan_result;
+		ctx.scan_result = NULL;
+		ctx.scan_result_ready = false;
+		ret = 0;
+	}
+	else if (ctx.scan_pending || ctx.scan_running) {
+		ret = -EBUSY;
+	}
+	else {
+		ret = -ENOENT;
+	}
+	k_mutex_unlock(&ctx.scan_lock);
+
+	return ret;
+}
+
+size_t dir_scan_get_progress(void)
+{
+	return atomic_get(&ctx.scan_progress);
+}
+
+void dir_scan_set_throttle(bool throttle)
+{
+	atomic_set(&ctx.scan_throttle, throttle);
+}
+
+size_t dir_prefix_get_bucket(const char *name)
+{
+	while (isspace((unsigned char)*name)) {
+		++name;
+	}
+	return prefix_bucket(*name);
+}
+
+char dir_prefix_get_label(size_t bucket)
+{
+	if (bucket == 0) {
+		return '#';
+	}
+	if (bucket == (DIR_PREFIX_BUCKETS - 1)) {
+		return '~';
+	}
+	return 'A' + (bucket - 1);
+}
+
+const char *dir_entry_get_name(const dir_list_t *list, const dir_entry_t *entry)
+{
+	return &list->names[entry->name_offset];
+}
+
+bool dir_entry_is_directory(const dir_entry_t *entry)
+{
+	return (entry->type == FS_DIR_ENTRY_DIR);
+}
+
+void dir_list_free(dir_list_t *list)
+{
+	if (list == NULL) {
+		return;
+	}
+
+	list_free_storage(list);
+	free(list);
+}
+
+void dir_cursor_init(dir_cursor_t *cursor, dir_list_t *list)
+{
+	cursor->list = list;
+	cursor->index = 0;
+}
+
+bool dir_cursor_is_valid(const dir_cursor_t *cursor)
+{
+	return ((cursor->list != NULL) && (cursor->list->total > 0));
+}
+
+dir_entry_t *dir_cursor_get_entry(const dir_cursor_t *cursor)
+{
+	if (!dir_cursor_is_valid(cursor)) {
+		return NULL;
+	}
+
+	dir_list_t *list = cursor->list;
+	if (window_load(list, cursor->index, 1) != 0) {
+		return NULL;
+	}
+	return &list->entries[cursor->index - list->window_offset];
+}
+
+const char *dir_cursor_get_name(const dir_cursor_t *cursor)
+{
+	const dir_entry_t *entry = dir_cursor_get_entry(cursor);
+	if (entry == NULL) {
+		return NULL;
+	}
+	return dir_entry_get_name(cursor->list, entry);
+}
+
+size_t dir_cursor_fetch(const dir_cursor_t *cursor, size_t count)
+{
+	if (!dir_cursor_is_valid(cursor)) {
+		return 0;
+	}
+
+	dir_list_t *list = cursor->list;
+	if (list->path == NULL) {
+		return UTILS_MIN(count, list->total);
+	}
+
+	count = UTILS_MIN(count, list->total - cursor->index);
+	if (window_load(list, cursor->index, count) != 0) {
+		return 0;
+	}
+	return count;
+}
+
+bool dir_cursor_fetch_needs_scan(const dir_cursor_t *cursor, size_t count)
+{
+	if (!dir_cursor_is_valid(cursor)) {
+		return false;
+	}
+
+	const dir_list_t *list = cursor->list;
+	if ((list->path == NULL) || list->indexed) {
+		return false;
+	}
+
+	const size_t end = UTILS_MIN(cursor->index + count, list->total);
+	return ((cursor->index < list->window_offset) || (end > (list->window_offset + list->count)));
+}
+
+uint32_t dir_cursor_get_duration_ms(const dir_cursor_t *cursor)
+{
+	library_entry_t record;
+
+	if (!dir_cursor_is_valid(cursor) || !cursor->list->indexed) {
+		return 0;
+	}
+	if (library_read_entries(&cursor->list->library_dir, cursor->index, &record, 1) != 0) {
+		return 0;
+	}
+	return record.duration_ms;
+}
+
+size_t dir_cursor_get_index(const dir_cursor_t *cursor)
+{
+	return cursor->index;
+}
+
+bool dir_cursor_is_last(const dir_cursor_t *cursor)
+{
+	return (!dir_cursor_is_valid(cursor) || (cursor->index == (cursor->list->total - 1)));
+}
+
+void dir_cursor_move(dir_cursor_t *cursor, int32_t offset)
+{
+	if (!dir_cursor_is_valid(cursor)) {
+		return;
+	}
+
+	const int32_t total = cursor->list->total;
+	int32_t index = ((int32_t)cursor->index + offset) % total;
+	if (index < 0) {
+		index += total;
+	}
+	cursor->index = index;
+}
+
+void dir_cursor_next(dir_cursor_t *cursor)
+{
+	dir_cursor_move(cursor, 1);
+}
+
+void dir_cursor_prev(dir_cursor_t *cursor)
+{
+	dir_cursor_move(cursor, -1);
+}
+
+void dir_cursor_jump(dir_cursor_t *cursor, size_t index)
+{
+	if (!dir_cursor_is_valid(cursor)) {
+		return;
+	}
+	cursor->index = UTILS_MIN(index, cursor->list->total - 1);
+}
+
+size_t dir_cursor_jump_bucket(dir_cursor_t *cursor, bool forward)
+{
+	if (!dir_cursor_is_valid(cursor)) {
+		return 0;
+	}
+
+	/* Bucket of entry under cursor is found in prefix table without reading the entry */
+	const dir_list_t *list = cursor->list;
+	size_t bucket = prefix_find(list, cursor->index);
+	for (size_t i = 0; i < DIR_PREFIX_BUCKETS; ++i) {
+		bucket = (bucket + (forward ? 1 : (DIR_PREFIX_BUCKETS - 1))) % DIR_PREFIX_BUCKETS;
+
+		if (prefix_get_end(list, bucket) > list->prefix_index[bucket]) {
+			cursor->index = list->prefix_index[bucket];
+			break;
+		}
+	}
+	return bucket;
 }
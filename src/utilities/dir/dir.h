@@ -7,10 +7,56 @@
 
 #pragma once
 
-#include "list.h"
+#include "library.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
 
-typedef struct list_t dir_list_t;
-typedef struct list_node_t dir_entry_t;
+#define DIR_CACHE_SIZE_MAX (1024 * 24) // RAM taken by cached listings, the most recent one is kept even if larger
+#define DIR_CACHE_ENTRIES_MAX 8
+#define DIR_PREFIX_BUCKETS 28 // Leading digit or symbol, 'A' to 'Z', then anything sorted after 'Z'
+
+typedef struct
+{
+	uint32_t name_offset; // Offset of null-terminated name in list's names arena
+	uint32_t size;
+	uint8_t type; // One of fs_dir_entry_type
+} dir_entry_t;
+
+/* Entries are kept in one array, sorted naturally ascending, their names are packed into a single arena.
+ * Directories too large to be held at once are listed in windows, re-read from card as cursor moves. */
+typedef struct
+{
+	dir_entry_t *entries;
+	size_t count;
+	size_t capacity;
+	char *names;
+	size_t names_size;
+	size_t names_capacity;
+	size_t total; // Entries in directory
+	size_t window_offset; // Index of entries[0] in directory
+	size_t anchor_index; // Index of entry window was last moved away from, SIZE_MAX if none
+	char *path; // Directory windows are read from, NULL if the whole directory is held
+	bool indexed; // Read from library index instead of directory itself
+	library_dir_t library_dir;
+	uint32_t prefix_index[DIR_PREFIX_BUCKETS]; // First entry of each bucket, equal to the next one's if empty
+} dir_list_t;
+
+typedef struct
+{
+	uint32_t hits;
+	uint32_t misses;
+	uint32_t evictions;
+	size_t size; // RAM currently taken by cached listings
+} dir_cache_stats_t;
+
+/* Position within a listing, all moves are constant-time. Reading entries may move window of the listing,
+ * so cursors of one listing have to be used by one thread at a time. */
+typedef struct
+{
+	dir_list_t *list;
+	size_t index;
+} dir_cursor_t;
 
 void dir_init(const char *root_path);
 
@@ -19,12 +65,71 @@ int dir_return(void);
 
 const char *dir_get_fs_path(void);
 
-dir_list_t *dir_list(void);
+/* Takes ownership of listing of current directory, keeping it with cursor position for when the directory is revisited.
+ * Returns -ENOMEM leaving listing with caller. */
+int dir_cache_put(dir_list_t *list, size_t cursor_index);
+
+/* Hands over cached listing of current directory and its cursor position, NULL if there's none */
+dir_list_t *dir_cache_get(size_t *cursor_index);
+
+void dir_cache_get_stats(dir_cache_stats_t *stats);
+
+/* Lists current directory on background thread, cancelling scan in progress */
+void dir_scan_start(void);
+void dir_scan_cancel(void);
+
+/* Hands over finished listing once, which can be NULL if directory could not be listed.
+ * Returns -EBUSY while scan is in progress and -ENOENT if there's nothing to hand over. */
+int dir_scan_get_result(dir_list_t **list);
+
+/* Entries read so far by scan in progress */
+size_t dir_scan_get_progress(void);
+
+/* Makes scanner pause periodically, leaving card bandwidth to playback */
+void dir_scan_set_throttle(bool throttle);
+
+/* Bucket of names starting like given one, leading whitespace and case are ignored just as when sorting */
+size_t dir_prefix_get_bucket(const char *name);
 
-/* Returns previous element, if there's no such, returns last (looped list) */
-dir_entry_t *dir_get_prev(dir_list_t *list, dir_entry_t *current);
+/* Character bucket is shown as */
+char dir_prefix_get_label(size_t bucket);
 
-/* Returns next element, if there's no such, returns first (looped list) */
-dir_entry_t *dir_get_next(dir_list_t *list, dir_entry_t *current);
+const char *dir_entry_get_name(const dir_list_t *list, const dir_entry_t *entry);
+bool dir_entry_is_directory(const dir_entry_t *entry);
 
 void dir_list_free(dir_list_t *list);
+
+/* Places cursor at the first entry, list can be NULL */
+void dir_cursor_init(dir_cursor_t *cursor, dir_list_t *list);
+
+/* Returns false if cursor has no list or the list is empty */
+bool dir_cursor_is_valid(const dir_cursor_t *cursor);
+
+/* Both return NULL if cursor is not valid. Can re-read windowed listing, invalidating entries and names
+ * obtained earlier, unless they were held together by dir_cursor_fetch. */
+dir_entry_t *dir_cursor_get_entry(const dir_cursor_t *cursor);
+const char *dir_cursor_get_name(const dir_cursor_t *cursor);
+
+/* Makes up to count entries starting at cursor available at once, returns how many are. Windowed
+ * listing does not wrap around past the last entry. */
+size_t dir_cursor_fetch(const dir_cursor_t *cursor, size_t count);
+
+/* Returns true if dir_cursor_fetch of count entries would have to read the whole directory again */
+bool dir_cursor_fetch_needs_scan(const dir_cursor_t *cursor, size_t count);
+
+/* Track duration from library index, 0 if not known */
+uint32_t dir_cursor_get_duration_ms(const dir_cursor_t *cursor);
+
+size_t dir_cursor_get_index(const dir_cursor_t *cursor);
+bool dir_cursor_is_last(const dir_cursor_t *cursor);
+
+/* Moves by given number of entries, wrapping around both ends (looped list) */
+void dir_cursor_move(dir_cursor_t *cursor, int32_t offset);
+void dir_cursor_next(dir_cursor_t *cursor);
+void dir_cursor_prev(dir_cursor_t *cursor);
+
+/* Moves to given index, clamped to the last entry */
+void dir_cursor_jump(dir_cursor_t *cursor, size_t index);
+
+/* Moves to the first entry of the nearest non-empty bucket in given direction, wrapping around. Returns the bucket. */
+size_t dir_cursor_jump_bucket(dir_cursor_t *cursor, bool forward);
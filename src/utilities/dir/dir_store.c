@@ -0,0 +1,336 @@
+#include "dir_store.h"
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/fs/nvs.h>
+#include <zephyr/drivers/flash.h>
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/sys/util.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#define DIR_STORE_PARTITION storage_partition
+#define DIR_STORE_VERSION 2
+#define DIR_STORE_TABLE_ID 1
+#define DIR_STORE_CHUNK_ID_BASE 0x100
+#define DIR_STORE_CHUNK_SIZE 1024 // Listings are split into NVS items of this size
+#define DIR_STORE_CHUNKS_MAX DIV_ROUND_UP(DIR_STORE_ENTRIES_MAX * sizeof(uint16_t), DIR_STORE_CHUNK_SIZE)
+
+#define DIR_STORE_FNV_OFFSET 0x811C9DC5
+#define DIR_STORE_FNV_PRIME 0x01000193
+
+typedef struct
+{
+	uint32_t path_hash; // 0 if slot is free
+	dir_store_fingerprint_t fingerprint;
+	uint32_t crc; // Of the whole listing, catches interrupted writes
+	uint32_t sequence; // Order slots were stored in, the oldest is replaced first
+} dir_store_slot_t;
+
+typedef struct
+{
+	uint32_t version;
+	uint32_t bytes_written_total;
+	uint32_t sequence;
+	dir_store_slot_t slots[DIR_STORE_SLOTS];
+} dir_store_table_t;
+
+typedef struct
+{
+	struct nvs_fs fs;
+	struct k_mutex lock; // Listings are stored and loaded by scanner thread, init runs before it starts
+	bool mounted;
+	dir_store_table_t table; // Mirrors table in flash, written only when listing is stored
+	dir_store_stats_t stats;
+} dir_store_ctx_t;
+
+static dir_store_ctx_t ctx;
+
+LOG_MODULE_REGISTER(dir_store);
+
+static uint32_t hash_string(const char *string)
+{
+	uint32_t hash = DIR_STORE_FNV_OFFSET;
+	while (*string != '\0') {
+		hash = (hash ^ (uint8_t)*string++) * DIR_STORE_FNV_PRIME;
+	}
+	return (hash != 0) ? hash : 1; // 0 marks free slot
+}
+
+static uint16_t chunk_id(size_t slot, size_t chunk)
+{
+	return DIR_STORE_CHUNK_ID_BASE + (slot * DIR_STORE_CHUNKS_MAX) + chunk;
+}
+
+/* Returns slot listing of given path should be stored in, it's replaced if there's none free */
+static dir_store_slot_t *slot_select(uint32_t path_hash, bool replace)
+{
+	dir_store_slot_t *oldest = &ctx.table.slots[0];
+
+	for (size_t i = 0; i < DIR_STORE_SLOTS; ++i) {
+		dir_store_slot_t *slot = &ctx.table.slots[i];
+		if (slot->path_hash == path_hash) {
+			return slot;
+		}
+		if ((oldest->path_hash != 0) && ((slot->path_hash == 0) || (slot->sequence < oldest->sequence))) {
+			oldest = slot;
+		}
+	}
+
+	return replace ? oldest : NULL;
+}
+
+/* Checks that every index appears exactly once, applying permutation would not terminate otherwise */
+static bool permutation_is_valid(const uint16_t *permutation, size_t count)
+{
+	uint32_t seen[DIV_ROUND_UP(DIR_STORE_ENTRIES_MAX, 32)] = {0};
+
+	for (size_t i = 0; i < count; ++i) {
+		const uint16_t index = permutation[i];
+		if ((index >= count) || (seen[index / 32] & BIT(index % 32))) {
+			return false;
+		}
+		seen[index / 32] |= BIT(index % 32);
+	}
+	return true;
+}
+
+/* Names arena is filled in the order entries were read in, so rank of name offset is entry's original index */
+static uint16_t original_index(const uint32_t *name_offsets, size_t count, uint32_t name_offset)
+{
+	size_t low = 0;
+	size_t high = count;
+
+	while (low < high) {
+		const size_t middle = low + ((high - low) / 2);
+		if (name_offsets[middle] < name_offset) {
+			low = middle + 1;
+		}
+		else {
+			high = middle;
+		}
+	}
+	return low;
+}
+
+int dir_store_init(void)
+{
+	struct flash_pages_info info;
+	int err;
+
+	k_mutex_init(&ctx.lock);
+
+	ctx.fs.flash_device = FIXED_PARTITION_DEVICE(DIR_STORE_PARTITION);
+	if (!device_is_ready(ctx.fs.flash_device)) {
+		LOG_ERR("Flash device not ready, listings will not be stored");
+		return -ENODEV;
+	}
+
+	ctx.fs.offset = FIXED_PARTITION_OFFSET(DIR_STORE_PARTITION);
+	err = flash_get_page_info_by_offs(ctx.fs.flash_device, ctx.fs.offset, &info);
+	if (err) {
+		return err;
+	}
+	ctx.fs.sector_size = info.size;
+	ctx.fs.sector_count = FIXED_PARTITION_SIZE(DIR_STORE_PARTITION) / info.size;
+
+	err = nvs_mount(&ctx.fs);
+	if (err) {
+		LOG_ERR("Failed to mount listing store, error %d", err);
+		return err;
+	}
+
+	const ssize_t bytes_read = nvs_read(&ctx.fs, DIR_STORE_TABLE_ID, &ctx.table, sizeof(ctx.table));
+	if ((bytes_read != sizeof(ctx.table)) || (ctx.table.version != DIR_STORE_VERSION)) {
+		memset(&ctx.table, 0, sizeof(ctx.table));
+		ctx.table.version = DIR_STORE_VERSION;
+	}
+
+	ctx.mounted = true;
+	LOG_INF("Listing store mounted, %u bytes written to it so far", ctx.table.bytes_written_total);
+
+	return 0;
+}
+
+void dir_store_fingerprint(const dir_list_t *list, dir_store_fingerprint_t *fingerprint)
+{
+	memset(fingerprint, 0, sizeof(*fingerprint));
+	fingerprint->count = list->count;
+
+	for (size_t i = 0; i < list->count; ++i) {
+		const dir_entry_t *entry = &list->entries[i];
+		fingerprint->size_sum += entry->size;
+		fingerprint->names_hash += hash_string(dir_entry_get_name(list, entry));
+	}
+}
+
+int dir_store_load(const char *path, const dir_store_fingerprint_t *fingerprint, dir_list_t *list)
+{
+	int err = 0;
+
+	if (!ctx.mounted || (list->count < DIR_STORE_ENTRIES_MIN) || (list->count > DIR_STORE_ENTRIES_MAX)) {
+		return -ENOENT;
+	}
+
+	k_mutex_lock(&ctx.lock, K_FOREVER);
+
+	const dir_store_slot_t *slot = slot_select(hash_string(path), false);
+	if ((slot == NULL) || (memcmp(&slot->fingerprint, fingerprint, sizeof(*fingerprint)) != 0)) {
+		++ctx.stats.misses;
+		k_mutex_unlock(&ctx.lock);
+		return -ENOENT;
+	}
+
+	/* Original index of each entry in sorted order */
+	const size_t size = list->count * sizeof(uint16_t);
+	uint16_t *permutation = malloc(size);
+	if (permutation == NULL) {
+		k_mutex_unlock(&ctx.lock);
+		return -ENOMEM;
+	}
+
+	const size_t slot_index = slot - ctx.table.slots;
+	uint8_t *data = (uint8_t *)permutation;
+	for (size_t offset = 0, chunk = 0; offset < size; offset += DIR_STORE_CHUNK_SIZE, ++chunk) {
+		const size_t chunk_size = MIN(DIR_STORE_CHUNK_SIZE, size - offset);
+		if (nvs_read(&ctx.fs, chunk_id(slot_index, chunk), &data[offset], chunk_size) != (ssize_t)chunk_size) {
+			err = -EIO;
+			break;
+		}
+	}
+
+	if (!err && ((crc32_ieee(data, size) != slot->crc) || !permutation_is_valid(permutation, list->count))) {
+		LOG_WRN("Stored listing of %s is corrupted", path);
+		err = -EIO;
+	}
+
+	if (!err) {
+		/* Apply permutation in place by following its cycles, done items are marked as fixed points */
+		for (size_t i = 0; i < list->count; ++i) {
+			if (permutation[i] == i) {
+				continue;
+			}
+
+			const dir_entry_t first = list->entries[i];
+			size_t current = i;
+			while (permutation[current] != i) {
+				const size_t source = permutation[current];
+				list->entries[current] = list->entries[source];
+				permutation[current] = current;
+				current = source;
+			}
+			list->entries[current] = first;
+			permutation[current] = current;
+		}
+		++ctx.stats.hits;
+	}
+	else {
+		++ctx.stats.misses;
+	}
+
+	free(permutation);
+	k_mutex_unlock(&ctx.lock);
+
+	return err;
+}
+
+int dir_store_save(const char *path, const dir_store_fingerprint_t *fingerprint, const dir_list_t *list)
+{
+	int err = 0;
+
+	if (!ctx.mounted) {
+		return -ENODEV;
+	}
+	if (list->count < DIR_STORE_ENTRIES_MIN) {
+		return 0;
+	}
+
+	if (list->count > DIR_STORE_ENTRIES_MAX) {
+		return -EFBIG;
+	}
+
+	const size_t size = list->count * sizeof(uint16_t);
+
+	k_mutex_lock(&ctx.lock, K_FOREVER);
+
+	/* Bounds wear, each flash sector survives about 10k erases */
+	if ((ctx.stats.bytes_written + size + sizeof(ctx.table)) > DIR_STORE_WRITE_BUDGET) {
+		++ctx.stats.saves_skipped;
+		LOG_WRN("Flash write budget used up, listing of %s not stored", path);
+		k_mutex_unlock(&ctx.lock);
+		return -ENOSPC;
+	}
+
+	uint16_t *permutation = malloc(size);
+	uint32_t *name_offsets = malloc(list->count * sizeof(*name_offsets));
+	if ((permutation == NULL) || (name_offsets == NULL)) {
+		free(permutation);
+		free(name_offsets);
+		k_mutex_unlock(&ctx.lock);
+		return -ENOMEM;
+	}
+
+	/* Start of every name in arena, ascending */
+	for (size_t i = 0, name_offset = 0; i < list->count; ++i) {
+		name_offsets[i] = name_offset;
+		name_offset += strlen(&list->names[name_offset]) + 1;
+	}
+	for (size_t i = 0; i < list->count; ++i) {
+		permutation[i] = original_index(name_offsets, list->count, list->entries[i].name_offset);
+	}
+	free(name_offsets);
+
+	dir_store_slot_t *slot = slot_select(hash_string(path), true);
+	const size_t slot_index = slot - ctx.table.slots;
+	const uint8_t *data = (const uint8_t *)permutation;
+
+	for (size_t offset = 0, chunk = 0; offset < size; offset += DIR_STORE_CHUNK_SIZE, ++chunk) {
+		const size_t chunk_size = MIN(DIR_STORE_CHUNK_SIZE, size - offset);
+		const ssize_t bytes_written = nvs_write(&ctx.fs, chunk_id(slot_index, chunk), &data[offset], chunk_size);
+		if (bytes_written < 0) {
+			err = bytes_written;
+			break;
+		}
+		ctx.stats.bytes_written += bytes_written; // 0 if NVS found the same data already stored
+		ctx.table.bytes_written_total += bytes_written;
+	}
+
+	if (!err) {
+		slot->path_hash = hash_string(path);
+		slot->fingerprint = *fingerprint;
+		slot->crc = crc32_ieee(data, size);
+		slot->sequence = ++ctx.table.sequence;
+
+		/* Table changes on every save, so it's always written */
+		ctx.stats.bytes_written += sizeof(ctx.table);
+		ctx.table.bytes_written_total += sizeof(ctx.table);
+
+		const ssize_t bytes_written = nvs_write(&ctx.fs, DIR_STORE_TABLE_ID, &ctx.table, sizeof(ctx.table));
+		if (bytes_written < 0) {
+			err = bytes_written;
+		}
+	}
+
+	if (err) {
+		LOG_ERR("Failed to store listing of %s, error %d", path, err);
+	}
+	else {
+		LOG_INF("Stored listing of %s, %u bytes written since boot, %u in total", path,
+				ctx.stats.bytes_written, ctx.table.bytes_written_total);
+	}
+
+	free(permutation);
+	k_mutex_unlock(&ctx.lock);
+
+	return err;
+}
+
+void dir_store_get_stats(dir_store_stats_t *stats)
+{
+	k_mutex_lock(&ctx.lock, K_FOREVER);
+	*stats = ctx.stats;
+	stats->bytes_written_total = ctx.table.bytes_written_total;
+	k_mutex_unlock(&ctx.lock);
+}
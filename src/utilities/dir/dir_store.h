@@ -0,0 +1,40 @@
+#pragma once
+
+#include "dir.h"
+#include <stdint.h>
+
+#define DIR_STORE_SLOTS 4 // Listings kept in flash, the oldest stored one is replaced
+#define DIR_STORE_ENTRIES_MIN 64 // Smaller listings sort quickly, not worth flash wear
+#define DIR_STORE_ENTRIES_MAX 1024 // Listing is stored as 2-byte permutation, 2 KiB at most
+#define DIR_STORE_WRITE_BUDGET (1024 * 16) // Flash bytes written per boot at most
+
+/* Computed from unsorted listing, does not depend on the order entries were read in */
+typedef struct
+{
+	uint32_t count;
+	uint32_t size_sum;
+	uint32_t names_hash; // Sum of hashes of all names
+} dir_store_fingerprint_t;
+
+typedef struct
+{
+	uint32_t hits;
+	uint32_t misses;
+	uint32_t bytes_written; // Since boot
+	uint32_t bytes_written_total; // Over device lifetime
+	uint32_t saves_skipped; // Over write budget
+} dir_store_stats_t;
+
+/* Mounts storage partition, listings are neither stored nor loaded if it fails */
+int dir_store_init(void);
+
+void dir_store_fingerprint(const dir_list_t *list, dir_store_fingerprint_t *fingerprint);
+
+/* Reorders unsorted list by stored permutation, returns -ENOENT if there's none with matching fingerprint.
+ * Directory read in different order than it was stored in ends up unsorted, caller has to check it. */
+int dir_store_load(const char *path, const dir_store_fingerprint_t *fingerprint, dir_list_t *list);
+
+/* List has to be sorted and not windowed, with names still in the order entries were read in */
+int dir_store_save(const char *path, const dir_store_fingerprint_t *fingerprint, const dir_list_t *list);
+
+void dir_store_get_stats(dir_store_stats_t *stats);
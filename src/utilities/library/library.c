@@ -0,0 +1,250 @@
+#include "library.h"
+#include <zephyr/fs/fs.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/util.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#define LIBRARY_MAGIC "SDLI"
+#define LIBRARY_VERSION 2
+#define LIBRARY_PATH_MAX (255 + 1)
+
+#define LIBRARY_FNV_OFFSET 0x811C9DC5
+#define LIBRARY_FNV_PRIME 0x01000193
+
+typedef struct
+{
+	char magic[4];
+	uint16_t version;
+	uint16_t header_size;
+	uint32_t dirs_count;
+	uint32_t dirs_offset;
+	uint32_t entries_count;
+	uint32_t entries_offset;
+	uint32_t hash_slots; // Power of two
+	uint32_t hash_offset;
+	uint32_t strings_size;
+	uint32_t strings_offset;
+	uint32_t root_count; // Fingerprint of card root, see root_is_unchanged()
+	uint32_t root_size_sum;
+	uint32_t root_names_hash; // Sum of hashes of all names
+} __packed library_header_t;
+
+typedef struct
+{
+	uint32_t path_offset;
+	uint32_t first_entry;
+	uint32_t entries_count;
+	uint32_t names_offset;
+	uint32_t names_size;
+} __packed library_dir_record_t;
+
+typedef struct
+{
+	struct fs_file_t fd;
+	struct k_mutex lock; // Index is read by GUI and directory scanner
+	bool available;
+	library_header_t header;
+	char path[LIBRARY_PATH_MAX]; // Path stored in index, read to resolve hash collisions
+} library_ctx_t;
+
+static library_ctx_t ctx;
+
+LOG_MODULE_REGISTER(library);
+
+/* Written by operating systems on their own, must not invalidate index */
+static const char *const root_ignored[] = {LIBRARY_FILE_NAME, "System Volume Information", "$RECYCLE.BIN"};
+
+static uint32_t hash_path(const char *path)
+{
+	uint32_t hash = LIBRARY_FNV_OFFSET;
+	while (*path != '\0') {
+		hash = (hash ^ (uint8_t)*path++) * LIBRARY_FNV_PRIME;
+	}
+	return hash;
+}
+
+/* Has to be called with lock held */
+static ssize_t read_at(uint32_t offset, void *buffer, size_t size)
+{
+	const int err = fs_seek(&ctx.fd, offset, FS_SEEK_SET);
+	if (err) {
+		return err;
+	}
+	return fs_read(&ctx.fd, buffer, size);
+}
+
+static int read_exact(uint32_t offset, void *buffer, size_t size)
+{
+	const ssize_t bytes_read = read_at(offset, buffer, size);
+	if (bytes_read < 0) {
+		return bytes_read;
+	}
+	return (bytes_read == (ssize_t)size) ? 0 : -EIO;
+}
+
+static bool root_is_ignored(const char *name)
+{
+	if (name[0] == '.') {
+		return true;
+	}
+	for (size_t i = 0; i < ARRAY_SIZE(root_ignored); ++i) {
+		if (strcmp(name, root_ignored[i]) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Compares entries of card root with the ones index was built from, in any order, reading only the root directory */
+static bool root_is_unchanged(const char *root_path)
+{
+	struct fs_dir_t dirp;
+	struct fs_dirent entry;
+	uint32_t count = 0;
+	uint32_t size_sum = 0;
+	uint32_t names_hash = 0;
+	int err;
+
+	fs_dir_t_init(&dirp);
+	if (fs_opendir(&dirp, root_path) != 0) {
+		return false;
+	}
+
+	while (1) {
+		err = fs_readdir(&dirp, &entry);
+		if ((err != 0) || (entry.name[0] == '\0')) {
+			break;
+		}
+		if (root_is_ignored(entry.name)) {
+			continue;
+		}
+
+		++count;
+		size_sum += (entry.type == FS_DIR_ENTRY_FILE) ? entry.size : 0;
+		names_hash += hash_path(entry.name);
+	}
+
+	fs_closedir(&dirp);
+
+	return ((err == 0) && (count == ctx.header.root_count) && (size_sum == ctx.header.root_size_sum) &&
+			(names_hash == ctx.header.root_names_hash));
+}
+
+int library_init(const char *root_path)
+{
+	char path[LIBRARY_PATH_MAX];
+	int err;
+
+	k_mutex_init(&ctx.lock);
+	fs_file_t_init(&ctx.fd);
+
+	snprintf(path, sizeof(path), "%s/%s", root_path, LIBRARY_FILE_NAME);
+	err = fs_open(&ctx.fd, path, FS_O_READ);
+	if (err) {
+		LOG_INF("No library index, directories will be listed from card");
+		return -ENOENT;
+	}
+
+	err = read_exact(0, &ctx.header, sizeof(ctx.header));
+	if (err || (memcmp(ctx.header.magic, LIBRARY_MAGIC, sizeof(ctx.header.magic)) != 0) ||
+		(ctx.header.version != LIBRARY_VERSION) || (ctx.header.hash_slots == 0)) {
+		LOG_WRN("Library index is not valid, ignoring it");
+		fs_close(&ctx.fd);
+		return -ENOENT;
+	}
+
+	if (!root_is_unchanged(root_path)) {
+		LOG_WRN("Card was modified after library index was built, ignoring it");
+		fs_close(&ctx.fd);
+		return -ENOENT;
+	}
+
+	ctx.available = true;
+	LOG_INF("Library index with %u directories, %u entries", ctx.header.dirs_count, ctx.header.entries_count);
+
+	return 0;
+}
+
+int library_find_dir(const char *path, library_dir_t *dir)
+{
+	library_dir_record_t record;
+	uint32_t slot_value;
+	int err = -ENOENT;
+
+	if (!ctx.available) {
+		return -ENOENT;
+	}
+
+	const size_t path_size = strlen(path) + 1;
+	if (path_size > sizeof(ctx.path)) {
+		return -ENAMETOOLONG;
+	}
+
+	k_mutex_lock(&ctx.lock, K_FOREVER);
+
+	/* Open addressing with linear probing, the table is never full */
+	const uint32_t mask = ctx.header.hash_slots - 1;
+	uint32_t slot = hash_path(path) & mask;
+
+	for (uint32_t probes = 0; probes < ctx.header.hash_slots; ++probes, slot = (slot + 1) & mask) {
+		if (read_exact(ctx.header.hash_offset + (slot * sizeof(slot_value)), &slot_value, sizeof(slot_value)) != 0) {
+			err = -EIO;
+			break;
+		}
+		if (slot_value == 0) {
+			break;
+		}
+
+		const uint32_t dir_offset = ctx.header.dirs_offset + ((slot_value - 1) * sizeof(record));
+		if (read_exact(dir_offset, &record, sizeof(record)) != 0) {
+			err = -EIO;
+			break;
+		}
+
+		const ssize_t bytes_read = read_at(ctx.header.strings_offset + record.path_offset, ctx.path, path_size);
+		if ((bytes_read == (ssize_t)path_size) && (memcmp(ctx.path, path, path_size) == 0)) {
+			dir->first_entry = record.first_entry;
+			dir->entries_count = record.entries_count;
+			dir->names_offset = record.names_offset;
+			dir->names_size = record.names_size;
+			err = 0;
+			break;
+		}
+	}
+
+	k_mutex_unlock(&ctx.lock);
+
+	return err;
+}
+
+int library_read_entries(const library_dir_t *dir, size_t first, library_entry_t *entries, size_t count)
+{
+	if (!ctx.available || ((first + count) > dir->entries_count)) {
+		return -EINVAL;
+	}
+
+	k_mutex_lock(&ctx.lock, K_FOREVER);
+	const int err = read_exact(ctx.header.entries_offset + ((dir->first_entry + first) * sizeof(*entries)), entries, count * sizeof(*entries));
+	k_mutex_unlock(&ctx.lock);
+
+	return err;
+}
+
+ssize_t library_read_strings(uint32_t offset, char *buffer, size_t size)
+{
+	if (!ctx.available || (offset >= ctx.header.strings_size)) {
+		return -EINVAL;
+	}
+
+	size = MIN(size, ctx.header.strings_size - offset);
+
+	k_mutex_lock(&ctx.lock, K_FOREVER);
+	const ssize_t bytes_read = read_at(ctx.header.strings_offset + offset, buffer, size);
+	k_mutex_unlock(&ctx.lock);
+
+	return bytes_read;
+}
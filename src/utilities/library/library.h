@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define LIBRARY_FILE_NAME "LIBRARY.IDX" // Written to card root by tools/indexer/sd_indexer.py
+
+/* Directory listing stored in index, sorted the same way as dir module sorts */
+typedef struct
+{
+	uint32_t first_entry;
+	uint32_t entries_count;
+	uint32_t names_offset; // Names of all entries, stored contiguously in strings pool
+	uint32_t names_size;
+} library_dir_t;
+
+/* Layout of entry in index file */
+typedef struct
+{
+	uint32_t name_offset; // In strings pool
+	uint32_t size;
+	uint8_t type; // One of fs_dir_entry_type
+	uint8_t reserved[3];
+	uint32_t duration_ms; // 0 if unknown
+} library_entry_t;
+
+/* Opens index in root of given path, returns -ENOENT if there's none, it's not valid or card root has changed since */
+int library_init(const char *root_path);
+
+/* Path is relative to card root, empty for root itself */
+int library_find_dir(const char *path, library_dir_t *dir);
+
+int library_read_entries(const library_dir_t *dir, size_t first, library_entry_t *entries, size_t count);
+
+/* Reads raw bytes of strings pool, returns number of bytes read */
+ssize_t library_read_strings(uint32_t offset, char *buffer, size_t size);
@@ -0,0 +1,60 @@
+#include "strnatxfrm.h"
+#include <ctype.h>
+#include <limits.h>
+
+#define STRNATXFRM_RUN_MARKER '1' // Between '0' and other digits, so it compares like the digit it replaces
+#define STRNATXFRM_RUN_END '\x01' // Below any character allowed in file names
+
+static void put(char *dest, size_t n, size_t *pos, char c)
+{
+	if (*pos < n) {
+		dest[*pos] = c;
+	}
+	++(*pos);
+}
+
+size_t strnatxfrm(char *dest, const char *src, size_t n, bool fold_case)
+{
+	size_t pos = 0;
+
+	while (*src != '\0') {
+		const unsigned char c = *src;
+
+		/* Whitespace is ignored, apart from ending a run of digits */
+		if (isspace(c)) {
+			++src;
+			continue;
+		}
+
+		if (!isdigit(c)) {
+			put(dest, n, &pos, fold_case ? toupper(c) : c);
+			++src;
+			continue;
+		}
+
+		size_t run = 0;
+		while (isdigit((unsigned char)src[run])) {
+			++run;
+		}
+
+		if (c == '0') {
+			/* Runs with leading zero are compared digit by digit, the shorter one first */
+			for (size_t i = 0; i < run; ++i) {
+				put(dest, n, &pos, src[i]);
+			}
+			put(dest, n, &pos, STRNATXFRM_RUN_END);
+		}
+		else {
+			/* Other runs are compared by length first, then by value */
+			put(dest, n, &pos, STRNATXFRM_RUN_MARKER);
+			put(dest, n, &pos, (char)((run < UCHAR_MAX) ? run : UCHAR_MAX));
+			for (size_t i = 0; i < run; ++i) {
+				put(dest, n, &pos, src[i]);
+			}
+		}
+
+		src += run;
+	}
+
+	return pos;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Transforms string into a collation key, so that memcmp on keys (shorter key first on common prefix) orders
+ * strings the same way as strnatcmp, or strnatcasecmp if fold_case is set. Writes at most n bytes, key is not
+ * null-terminated. Returns full key length, like strxfrm. */
+size_t strnatxfrm(char *dest, const char *src, size_t n, bool fold_case);
@@ -0,0 +1,84 @@
+#!/usr/bin/env python3
+"""Generates column-major (SSD1306 page-native) tables of 8 px high fonts in ssd1306_fonts.c.
+
+Row-major font arrays keep one uint16_t per pixel row, leftmost pixel in the MSB.
+Generated tables keep one byte per glyph column, topmost pixel in the LSB - the
+layout of a display page - so that page-aligned glyphs are copied to framebuffer
+as whole bytes. Tables are rewritten in place, between generated-block markers
+following each font's row-major array. Usage:
+
+    font_columns.py src/ssd1306/ssd1306_fonts.c
+
+Re-run it after editing any 8 px high font.
+"""
+
+import argparse
+import re
+import sys
+
+BEGIN_MARKER = "/* Generated by tools/fonts/font_columns.py, do not edit */"
+END_MARKER = "/* End of generated block */"
+
+FONT_PATTERN = re.compile(r"static const uint16_t (Font(\d+)x8) \[\] = \{(.*?)\};\n", re.S)
+COMMENT_PATTERN = re.compile(r"//\s*(.*)")
+
+
+def parse_glyphs(body):
+    """Returns list of (rows, comment) tuples, one per source line"""
+    glyphs = []
+    for line in body.strip().splitlines():
+        comment = COMMENT_PATTERN.search(line)
+        values = [int(value, 16) for value in re.findall(r"0x[0-9a-fA-F]+", line.split("//")[0])]
+        if values:
+            glyphs.append((values, comment.group(1).strip() if comment else ""))
+    return glyphs
+
+
+def to_columns(rows, width):
+    columns = []
+    for column in range(width):
+        byte = 0
+        for row, data in enumerate(rows):
+            if (data << column) & 0x8000:
+                byte |= 1 << row
+        columns.append(byte)
+    return columns
+
+
+def generate(name, width, body):
+    lines = [BEGIN_MARKER, "static const uint8_t %s_columns [] = {" % name]
+    for rows, comment in parse_glyphs(body):
+        if len(rows) != 8:
+            raise ValueError("%s: glyph '%s' has %d rows instead of 8" % (name, comment, len(rows)))
+        values = ", ".join("0x%02x" % byte for byte in to_columns(rows, width))
+        lines.append("%s,  // %s" % (values, comment))
+    lines.append("};")
+    lines.append(END_MARKER)
+    return "\n".join(lines) + "\n"
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("fonts", help="path to ssd1306_fonts.c")
+    args = parser.parse_args()
+
+    with open(args.fonts) as f:
+        source = f.read()
+
+    # Drop blocks generated previously, then add fresh ones after each source array
+    source = re.sub(re.escape(BEGIN_MARKER) + r".*?" + re.escape(END_MARKER) + r"\n", "", source, flags=re.S)
+
+    def replace(match):
+        return match.group(0) + generate(match.group(1), int(match.group(2)), match.group(3))
+
+    source, count = FONT_PATTERN.subn(replace, source)
+
+    with open(args.fonts, "w") as f:
+        f.write(source)
+
+    print("%d font(s) converted" % count)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
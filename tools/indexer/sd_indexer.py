@@ -0,0 +1,361 @@
+#!/usr/bin/env python3
+"""Builds library index of a mounted SD card (or loop-mounted image) for the player.
+
+The index holds every directory listing already sorted the way firmware sorts it,
+so that browsing needs a few small reads instead of walking FAT. Usage:
+
+    sd_indexer.py /media/sdcard
+
+Re-run it whenever card contents change; firmware ignores the index once entries
+in card root differ from the ones recorded, and falls back to listing
+directories itself when it finds a directory below does not match.
+
+File layout, all integers little-endian:
+    header      magic "SDLI", u16 version, u16 header size, then u32 pairs of
+                (count, offset) for directories, entries and hash slots, then
+                u32 strings size and offset, then fingerprint of card root:
+                u32 entries count, u32 sum of file sizes, u32 sum of FNV-1a
+                hashes of names; dot files, the index and folders operating
+                systems create on their own are left out of it
+    directory   u32 path offset, u32 first entry, u32 entries count,
+                u32 names offset, u32 names size
+    entry       u32 name offset, u32 size, u8 type, 3 reserved bytes,
+                u32 duration in ms
+    hash slot   u32 directory index + 1, 0 if empty; FNV-1a of directory path,
+                linear probing
+    strings     null-terminated, names of each directory stored contiguously
+
+Directory paths are relative to card root, "" for root itself, "/Artist/Album"
+otherwise. Names are encoded with the FatFs codepage firmware is built with.
+"""
+
+import argparse
+import os
+import struct
+import sys
+
+INDEX_FILE_NAME = "LIBRARY.IDX"
+INDEX_MAGIC = b"SDLI"
+INDEX_VERSION = 2
+
+HEADER_FORMAT = "<4sHH11I"
+DIR_FORMAT = "<5I"
+ENTRY_FORMAT = "<IIB3xI"
+
+ROOT_IGNORED = (INDEX_FILE_NAME, "System Volume Information", "$RECYCLE.BIN")
+
+TYPE_FILE = 0
+TYPE_DIR = 1
+
+FNV_OFFSET = 0x811C9DC5
+FNV_PRIME = 0x01000193
+
+WHITESPACE = b" \t\n\v\f\r"
+RUN_MARKER = 0x31
+RUN_END = 0x01
+
+
+def natural_key(name):
+    """Port of strnatxfrm with case folding, compares like strnatcasecmp"""
+    key = bytearray()
+    i = 0
+    while i < len(name):
+        c = name[i]
+        if c in WHITESPACE:
+            i += 1
+            continue
+        if not 0x30 <= c <= 0x39:
+            key.append(c - 0x20 if 0x61 <= c <= 0x7A else c)
+            i += 1
+            continue
+
+        end = i
+        while end < len(name) and 0x30 <= name[end] <= 0x39:
+            end += 1
+        run = name[i:end]
+        if c == 0x30:
+            key += run
+            key.append(RUN_END)
+        else:
+            key.append(RUN_MARKER)
+            key.append(min(len(run), 0xFF))
+            key += run
+        i = end
+    return bytes(key)
+
+
+def sort_key(name):
+    """Same order as compare_names in dir.c - natural, then plain byte comparison"""
+    return (natural_key(name), name)
+
+
+def fnv1a(data):
+    value = FNV_OFFSET
+    for byte in data:
+        value = ((value ^ byte) * FNV_PRIME) & 0xFFFFFFFF
+    return value
+
+
+def syncsafe(data):
+    return (data[0] << 21) | (data[1] << 14) | (data[2] << 7) | data[3]
+
+
+MP3_BITRATES = {
+    # (MPEG1, layer III), (MPEG2/2.5, layer III), kbps
+    1: [0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320],
+    2: [0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160],
+}
+MP3_SAMPLE_RATES = {
+    3: [44100, 48000, 32000],  # MPEG1
+    2: [22050, 24000, 16000],  # MPEG2
+    0: [11025, 12000, 8000],  # MPEG2.5
+}
+
+
+def parse_mp3_frame(header):
+    if len(header) < 4 or header[0] != 0xFF or (header[1] & 0xE0) != 0xE0:
+        return None
+    version = (header[1] >> 3) & 0x03
+    layer = (header[1] >> 1) & 0x03
+    bitrate_index = header[2] >> 4
+    rate_index = (header[2] >> 2) & 0x03
+    if version == 1 or layer != 1 or bitrate_index in (0, 15) or rate_index == 3:
+        return None  # Reserved, not layer III, free format or bad
+    mpeg1 = version == 3
+    bitrate = MP3_BITRATES[1 if mpeg1 else 2][bitrate_index] * 1000
+    sample_rate = MP3_SAMPLE_RATES[version][rate_index]
+    padding = (header[2] >> 1) & 0x01
+    mono = (header[3] >> 6) == 3
+    samples = 1152 if mpeg1 else 576
+    frame_size = (samples // 8) * bitrate // sample_rate + padding
+    side_info = (17 if mono else 32) if mpeg1 else (9 if mono else 17)
+    return sample_rate, samples, frame_size, bitrate, side_info
+
+
+def probe_mp3(f, size):
+    data = f.read(10)
+    offset = 0
+    if data[:3] == b"ID3" and len(data) == 10:
+        offset = 10 + syncsafe(data[6:10]) + (10 if data[5] & 0x10 else 0)
+
+    f.seek(offset)
+    data = f.read(8192 + 256)
+    for i in range(max(len(data) - 4, 0)):
+        frame = parse_mp3_frame(data[i : i + 4])
+        if frame is None:
+            continue
+        sample_rate, samples, frame_size, bitrate, side_info = frame
+        following = parse_mp3_frame(data[i + frame_size : i + frame_size + 4])
+        if following is None and i + frame_size + 4 <= len(data):
+            continue  # False sync
+        audio_offset = offset + i
+        frames = None
+
+        tag = data[i + 4 + side_info : i + 4 + side_info + 12]
+        if tag[:4] in (b"Xing", b"Info") and len(tag) == 12 and struct.unpack(">I", tag[4:8])[0] & 0x01:
+            frames = struct.unpack(">I", tag[8:12])[0]
+        vbri = data[i + 36 : i + 36 + 18]
+        if vbri[:4] == b"VBRI" and len(vbri) == 18:
+            frames = struct.unpack(">I", vbri[14:18])[0]
+
+        if frames is not None:
+            return frames * samples * 1000 // sample_rate
+        return (size - audio_offset) * 8 * 1000 // bitrate
+    return 0
+
+
+def probe_wav(f, size):
+    data = f.read(12)
+    if data[:4] != b"RIFF" or data[8:12] != b"WAVE":
+        return 0
+    sample_rate = block_align = 0
+    while True:
+        chunk = f.read(8)
+        if len(chunk) < 8:
+            return 0
+        chunk_id, chunk_size = struct.unpack("<4sI", chunk)
+        if chunk_id == b"fmt ":
+            fmt = f.read(chunk_size + (chunk_size & 1))
+            sample_rate = struct.unpack("<I", fmt[4:8])[0]
+            block_align = struct.unpack("<H", fmt[12:14])[0]
+        elif chunk_id == b"data":
+            if sample_rate == 0 or block_align == 0:
+                return 0
+            frames = min(chunk_size, size - f.tell()) // block_align
+            return frames * 1000 // sample_rate
+        else:
+            f.seek(chunk_size + (chunk_size & 1), os.SEEK_CUR)
+
+
+def probe_flac(f, size):
+    if f.read(4) != b"fLaC":
+        return 0
+    sample_rate = frames = 0
+    while True:
+        block = f.read(4)
+        if len(block) < 4:
+            return 0
+        last = block[0] & 0x80
+        block_type = block[0] & 0x7F
+        block_size = int.from_bytes(block[1:4], "big")
+        if block_type == 0:
+            info = f.read(block_size)
+            packed = int.from_bytes(info[10:18], "big")
+            sample_rate = packed >> 44
+            frames = packed & ((1 << 36) - 1)
+        else:
+            f.seek(block_size, os.SEEK_CUR)
+        if last:
+            break
+    if sample_rate == 0:
+        return 0
+    return frames * 1000 // sample_rate
+
+
+PROBES = {".mp3": probe_mp3, ".wav": probe_wav, ".flac": probe_flac}
+
+
+def probe(path, size):
+    """Returns duration in ms, 0 if unknown"""
+    probe_format = PROBES.get(os.path.splitext(path)[1].lower())
+    if probe_format is None:
+        return 0
+    try:
+        with open(path, "rb") as f:
+            return probe_format(f, size)
+    except (OSError, struct.error, IndexError, ZeroDivisionError):
+        return 0
+
+
+class Index:
+    def __init__(self, codepage):
+        self.codepage = codepage
+        self.dirs = []  # (path offset, first entry, entries count, names offset, names size)
+        self.entries = []
+        self.strings = bytearray()
+
+    def add_string(self, string):
+        offset = len(self.strings)
+        self.strings += string + b"\0"
+        return offset
+
+    def encode(self, name):
+        # FatFs returns '?' for characters missing in codepage
+        return name.encode(self.codepage, errors="replace")
+
+    def add_dir(self, fs_path, index_path, is_root):
+        listing = []
+        with os.scandir(fs_path) as scan:
+            for entry in scan:
+                is_dir = entry.is_dir(follow_symlinks=False)
+                size = 0 if is_dir else entry.stat(follow_symlinks=False).st_size
+                listing.append((self.encode(entry.name), entry.name, is_dir, size))
+
+        # Index file is going to be listed by firmware too, its size is patched in once known
+        if is_root and not any(name == INDEX_FILE_NAME for _, name, _, _ in listing):
+            listing.append((self.encode(INDEX_FILE_NAME), INDEX_FILE_NAME, False, 0))
+
+        listing.sort(key=lambda item: sort_key(item[0]))
+
+        path_offset = self.add_string(index_path)
+        first_entry = len(self.entries)
+        names_offset = len(self.strings)
+        for encoded, _, is_dir, size in listing:
+            self.entries.append([self.add_string(encoded), size & 0xFFFFFFFF, TYPE_DIR if is_dir else TYPE_FILE, 0])
+        self.dirs.append((path_offset, first_entry, len(listing), names_offset, len(self.strings) - names_offset))
+
+        for i, (encoded, name, is_dir, size) in enumerate(listing):
+            if is_dir:
+                self.add_dir(os.path.join(fs_path, name), index_path + b"/" + encoded, False)
+            else:
+                self.entries[first_entry + i][3] = probe(os.path.join(fs_path, name), size)
+
+    def set_index_size(self, size):
+        _, first_entry, count, _, _ = self.dirs[0]
+        encoded = self.encode(INDEX_FILE_NAME) + b"\0"
+        for entry in self.entries[first_entry : first_entry + count]:
+            if self.strings[entry[0] : entry[0] + len(encoded)] == encoded:
+                entry[1] = size
+
+    def root_fingerprint(self, root):
+        """Same as root_is_unchanged in library.c, sums do not depend on order entries are listed in"""
+        count = size_sum = names_hash = 0
+        with os.scandir(root) as scan:
+            for entry in scan:
+                if entry.name.startswith(".") or entry.name in ROOT_IGNORED:
+                    continue
+                count += 1
+                if not entry.is_dir(follow_symlinks=False):
+                    size_sum += entry.stat(follow_symlinks=False).st_size
+                names_hash += fnv1a(self.encode(entry.name))
+        return count, size_sum & 0xFFFFFFFF, names_hash & 0xFFFFFFFF
+
+    def serialize(self, root_fingerprint=(0, 0, 0)):
+        slots = 1
+        while slots < 2 * len(self.dirs):
+            slots *= 2
+        table = [0] * slots
+        for i, directory in enumerate(self.dirs):
+            path = self.strings[directory[0] : self.strings.index(b"\0", directory[0])]
+            slot = fnv1a(path) & (slots - 1)
+            while table[slot] != 0:
+                slot = (slot + 1) & (slots - 1)
+            table[slot] = i + 1
+
+        header_size = struct.calcsize(HEADER_FORMAT)
+        dirs_offset = header_size
+        entries_offset = dirs_offset + len(self.dirs) * struct.calcsize(DIR_FORMAT)
+        hash_offset = entries_offset + len(self.entries) * struct.calcsize(ENTRY_FORMAT)
+        strings_offset = hash_offset + slots * 4
+
+        data = bytearray(
+            struct.pack(
+                HEADER_FORMAT,
+                INDEX_MAGIC,
+                INDEX_VERSION,
+                header_size,
+                len(self.dirs),
+                dirs_offset,
+                len(self.entries),
+                entries_offset,
+                slots,
+                hash_offset,
+                len(self.strings),
+                strings_offset,
+                *root_fingerprint,
+            )
+        )
+        for directory in self.dirs:
+            data += struct.pack(DIR_FORMAT, *directory)
+        for entry in self.entries:
+            data += struct.pack(ENTRY_FORMAT, *entry)
+        data += struct.pack("<%dI" % slots, *table)
+        data += self.strings
+        return bytes(data)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("root", help="mount point of the card")
+    parser.add_argument("--codepage", default="cp852", help="matches CONFIG_FS_FATFS_CODEPAGE, default: %(default)s")
+    parser.add_argument("--output", help="index path, default: <root>/" + INDEX_FILE_NAME)
+    args = parser.parse_args()
+
+    index = Index(args.codepage)
+    index.add_dir(args.root, b"", True)
+    root_fingerprint = index.root_fingerprint(args.root)
+    data = index.serialize(root_fingerprint)
+    # Records have fixed size, so patching the size does not change it
+    index.set_index_size(len(data))
+    data = index.serialize(root_fingerprint)
+
+    output = args.output or os.path.join(args.root, INDEX_FILE_NAME)
+    with open(output, "wb") as f:
+        f.write(data)
+
+    print("%d directories, %d entries, %d bytes written to %s" % (len(index.dirs), len(index.entries), len(data), output))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())